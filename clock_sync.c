@@ -0,0 +1,109 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Fred Sundvik
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "clock_sync.h"
+#include <string.h>
+
+static int32_t predicted_offset(const clock_sync_t* sync, uint32_t local_time) {
+    int32_t elapsed = local_time - sync->reference;
+    return sync->offset + (int32_t)(((int64_t)sync->drift * elapsed) >> CLOCK_SYNC_DRIFT_SHIFT);
+}
+
+static void start_window(clock_sync_t* sync) {
+    sync->window_samples = 0;
+    sync->window_error = INT32_MIN;
+}
+
+void clock_sync_init(clock_sync_t* sync, uint32_t link_delay) {
+    memset(sync, 0, sizeof(*sync));
+    sync->link_delay = link_delay;
+}
+
+uint32_t clock_sync_master_time(const clock_sync_t* sync, uint32_t local_time) {
+    return local_time + predicted_offset(sync, local_time);
+}
+
+// The best sample of a window is the new reference, and the drift is measured
+// from the anchor to it
+static void end_window(clock_sync_t* sync) {
+    if (!sync->has_anchor) {
+        sync->anchor_local = sync->window_local;
+        sync->anchor_offset = sync->window_offset;
+        sync->has_anchor = true;
+    }
+    else {
+        uint32_t baseline = sync->window_local - sync->anchor_local;
+        if (baseline >= CLOCK_SYNC_MIN_BASELINE) {
+            int64_t change = (int64_t)(sync->window_offset - sync->anchor_offset);
+            sync->drift = (int32_t)((change << CLOCK_SYNC_DRIFT_SHIFT) / (int64_t)baseline);
+        }
+        // Measure from a newer sample, so that the drift follows the changes
+        // of the temperature
+        if (baseline >= CLOCK_SYNC_MAX_BASELINE) {
+            sync->anchor_local = sync->window_local;
+            sync->anchor_offset = sync->window_offset;
+        }
+    }
+    sync->reference = sync->window_local;
+    sync->offset = sync->window_offset;
+    start_window(sync);
+}
+
+void clock_sync_update(clock_sync_t* sync, uint32_t master_time, uint32_t local_time) {
+    // The delay is at least link_delay, so the real offset is at least this
+    int32_t offset = master_time + sync->link_delay - local_time;
+    int32_t error = 0;
+    if (sync->synchronized) {
+        error = offset - predicted_offset(sync, local_time);
+        if (error > CLOCK_SYNC_MAX_ERROR || error < -CLOCK_SYNC_MAX_ERROR) {
+            sync->synchronized = false;
+        }
+    }
+    if (!sync->synchronized) {
+        uint8_t generation = sync->generation + 1;
+        clock_sync_init(sync, sync->link_delay);
+        sync->generation = generation;
+        sync->synchronized = true;
+        sync->reference = local_time;
+        sync->offset = offset;
+        start_window(sync);
+    }
+    else if (error > 0) {
+        // The estimate is certainly behind, so move it to the sample, which
+        // then is the best one of the window
+        sync->reference = local_time;
+        sync->offset = offset;
+        error = 0;
+        sync->window_error = INT32_MIN;
+    }
+    if (error >= sync->window_error) {
+        sync->window_local = local_time;
+        sync->window_offset = offset;
+        sync->window_error = error;
+    }
+    if (++sync->window_samples == CLOCK_SYNC_WINDOW) {
+        end_window(sync);
+    }
+}
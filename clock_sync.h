@@ -0,0 +1,91 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Fred Sundvik
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef CLOCK_SYNC_H_
+#define CLOCK_SYNC_H_
+#include <stdint.h>
+#include <stdbool.h>
+
+// Estimates the clock of the master half of a split keyboard on a slave,
+// from the timestamps that the master sends over the serial link. The times
+// are 32-bit system ticks of the two halves.
+//
+// The timestamps arrive after a varying delay. The packet with the shortest
+// delay gives the most accurate offset between the clocks, so the estimate
+// follows the samples that are ahead of it immediately, and is moved back to
+// the best sample of each window of CLOCK_SYNC_WINDOW samples. The drift
+// between the crystals is measured from the change of the best samples over
+// at least CLOCK_SYNC_MIN_BASELINE ticks. The fixed part of the delay, the
+// transfer time of the packet, can be given to clock_sync_init.
+
+#ifndef CLOCK_SYNC_WINDOW
+#define CLOCK_SYNC_WINDOW 16
+#endif
+// The shortest and the longest time that the drift is measured over, the
+// defaults are for 1 kHz ticks
+#ifndef CLOCK_SYNC_MIN_BASELINE
+#define CLOCK_SYNC_MIN_BASELINE 10000
+#endif
+#ifndef CLOCK_SYNC_MAX_BASELINE
+#define CLOCK_SYNC_MAX_BASELINE 60000
+#endif
+// A sample further than this from the estimate means that the master was
+// restarted, or the link was down for a long time, so the estimate starts over
+#ifndef CLOCK_SYNC_MAX_ERROR
+#define CLOCK_SYNC_MAX_ERROR 100
+#endif
+
+// The drift is a fixed point fraction with this many bits
+#define CLOCK_SYNC_DRIFT_SHIFT 24
+
+typedef struct {
+    uint32_t link_delay;
+    // The master time is local + offset + drift * (local - reference)
+    uint32_t reference;
+    int32_t offset;
+    int32_t drift;
+    // The first best sample that the drift is measured from
+    uint32_t anchor_local;
+    int32_t anchor_offset;
+    bool has_anchor;
+    // The sample with the shortest delay in the current window
+    uint32_t window_local;
+    int32_t window_offset;
+    int32_t window_error;
+    uint8_t window_samples;
+    // Incremented whenever the estimate starts over, which makes the master
+    // time jump
+    uint8_t generation;
+    bool synchronized;
+} clock_sync_t;
+
+void clock_sync_init(clock_sync_t* sync, uint32_t link_delay);
+// Adds a sample, master_time is the timestamp in a packet and local_time the
+// time when it was received
+void clock_sync_update(clock_sync_t* sync, uint32_t master_time, uint32_t local_time);
+// The estimated master time at the given local time, only valid when
+// synchronized is set
+uint32_t clock_sync_master_time(const clock_sync_t* sync, uint32_t local_time);
+
+#endif /* CLOCK_SYNC_H_ */
@@ -26,6 +26,7 @@ SOFTWARE.
 #include "action_layer.h"
 #include "visualizer.h"
 #include "host.h"
+#include "hook.h"
 
 void post_keyboard_init(void) {
     visualizer_init();
@@ -34,3 +35,9 @@ void post_keyboard_init(void) {
 void post_keyboard_task() {
     visualizer_set_state(default_layer_state, layer_state, host_keyboard_leds());
 }
+
+#ifdef VISUALIZER_KEY_EVENTS
+void hook_matrix_change(keyevent_t event) {
+    visualizer_key_event(event.key.row, event.key.col, event.pressed);
+}
+#endif
@@ -322,4 +322,27 @@
 //#define GMISC_NEED_MATRIXFLOAT2D                     FALSE
 //#define GMISC_NEED_MATRIXFIXED2D                     FALSE
 
+///////////////////////////////////////////////////////////////////////////
+// Visualizer                                                            //
+///////////////////////////////////////////////////////////////////////////
+// Set to TRUE if your display driver handles GDISP_CONTROL_LCD_FLUSH_AREA
+// see lcd_display.h. This also needs GDISP_NEED_CONTROL
+#define LCD_PARTIAL_FLUSH                            FALSE
+// Set to TRUE if your display driver keeps a 1 bit per pixel framebuffer in
+// pages, and returns it for GDISP_QUERY_LCD_FRAMEBUFFER, see lcd_display.h.
+// This also needs GDISP_NEED_QUERY, and the monochrome pixel format, which
+// is selected below
+//#define LCD_PACKED_FRAMEBUFFER                       FALSE
+#if defined(LCD_PACKED_FRAMEBUFFER) && LCD_PACKED_FRAMEBUFFER
+    #undef GDISP_PIXELFORMAT
+    #define GDISP_PIXELFORMAT                        GDISP_PIXELFORMAT_MONO
+#endif
+// The number of bytes to use for caching rendered frames, each frame needs
+// width * height * sizeof(pixel_t) bytes. This also needs GDISP_NEED_PIXELREAD
+// With LCD_PACKED_FRAMEBUFFER each frame needs width * height / 8 bytes
+//#define LCD_FRAME_CACHE_SIZE                         0
+// The number of bytes to use for the pre-rendered glyphs of the monospaced
+// fonts, fixed_5x8 needs 570 bytes. Only used with LCD_PACKED_FRAMEBUFFER
+//#define LCD_GLYPH_CACHE_SIZE                         0
+
 #endif /* _GFXCONF_H */
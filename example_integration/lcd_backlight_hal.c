@@ -51,7 +51,48 @@ SOFTWARE.
 // Which will reduce the brightness range
 #define PRESCALAR_DEFINE 0
 
+#ifdef LCD_BACKLIGHT_WAVEFORM
+// The waveform is played back from a virtual timer callback, so the
+// visualizer thread can sleep during the fade. A DMA channel triggered by one
+// of the PIT timers could write the CnV registers without waking the CPU at
+// all, but the callback is only a few register writes per period.
+static virtual_timer_t waveform_timer;
+static const lcd_backlight_rgb_t* waveform;
+static uint16_t waveform_count;
+static uint16_t waveform_pos;
+static systime_t waveform_period;
+
+static void waveform_callback(void* arg) {
+    (void)arg;
+    const lcd_backlight_rgb_t* value = &waveform[waveform_pos++];
+	CHANNEL_RED.CnV = value->r;
+	CHANNEL_GREEN.CnV = value->g;
+	CHANNEL_BLUE.CnV = value->b;
+    if (waveform_pos < waveform_count) {
+        chSysLockFromISR();
+        chVTSetI(&waveform_timer, waveform_period, waveform_callback, NULL);
+        chSysUnlockFromISR();
+    }
+}
+
+void lcd_backlight_hal_play(const lcd_backlight_rgb_t* values, uint16_t count, uint16_t period_ms) {
+    chSysLock();
+    chVTResetI(&waveform_timer);
+    waveform = values;
+    waveform_count = count;
+    waveform_pos = 0;
+    waveform_period = MS2ST(period_ms);
+    if (count > 0) {
+        chVTSetI(&waveform_timer, waveform_period, waveform_callback, NULL);
+    }
+    chSysUnlock();
+}
+#endif
+
 void lcd_backlight_hal_init(void) {
+#ifdef LCD_BACKLIGHT_WAVEFORM
+    chVTObjectInit(&waveform_timer);
+#endif
 	// Setup Backlight
     SIM->SCGC6 |= SIM_SCGC6_FTM0;
     FTM0->CNT = 0; // Reset counter
@@ -84,6 +125,11 @@ void lcd_backlight_hal_init(void) {
 }
 
 void lcd_backlight_hal_color(uint16_t r, uint16_t g, uint16_t b) {
+#ifdef LCD_BACKLIGHT_WAVEFORM
+    chSysLock();
+    chVTResetI(&waveform_timer);
+    chSysUnlock();
+#endif
 	CHANNEL_RED.CnV = r;
 	CHANNEL_GREEN.CnV = g;
 	CHANNEL_BLUE.CnV = b;
@@ -50,6 +50,9 @@ bool display_welcome(keyframe_animation_t* animation, visualizer_state_t* state)
     gdispDrawString(0, 15, welcome_text[1], state->font_dejavusansbold12, Black);
     // Always remember to flush the display
     gdispFlush();
+    // And tell the visualizer that the screen has been changed, so that the
+    // built-in keyframes know that they have to redraw everything
+    lcd_display_invalidate();
     // you could set the backlight color as well, but we won't do it here, since
     // it's part of the following animation
     // lcd_backlight_color(hue, saturation, intensity);
@@ -61,33 +64,80 @@ bool display_welcome(keyframe_animation_t* animation, visualizer_state_t* state)
 
 // Don't worry, if the startup animation is long, you can use the keyboard like normal
 // during that time
-static keyframe_animation_t startup_animation = {
-    .num_frames = 4,
+static const keyframe_t startup_keyframes[] = {
+    {0, display_welcome},
+    {MS2ST(1000), keyframe_animate_backlight_color},
+    {MS2ST(5000), keyframe_no_operation},
+    {0, enable_visualization},
+};
+
+static const keyframe_animation_descriptor_t startup_animation_descriptor = {
+    KEYFRAMES(startup_keyframes),
     .loop = false,
-    .frame_lengths = {0, MS2ST(1000), MS2ST(5000), 0},
-    .frame_functions = {display_welcome, keyframe_animate_backlight_color, keyframe_no_operation, enable_visualization},
 };
 
+static keyframe_animation_t startup_animation = { .descriptor = &startup_animation_descriptor };
+
 // The color animation animates the LCD color when you change layers
-static keyframe_animation_t color_animation = {
-    .num_frames = 2,
-    .loop = false,
+static const keyframe_t color_keyframes[] = {
     // Note that there's a 200 ms no-operation frame,
     // this prevents the color from changing when activating the layer
     // momentarily
-    .frame_lengths = {MS2ST(200), MS2ST(500)},
-    .frame_functions = {keyframe_no_operation, keyframe_animate_backlight_color},
+    {MS2ST(200), keyframe_no_operation},
+    {MS2ST(500), keyframe_animate_backlight_color},
 };
 
+static const keyframe_animation_descriptor_t color_animation_descriptor = {
+    KEYFRAMES(color_keyframes),
+    .loop = false,
+};
+
+static keyframe_animation_t color_animation = { .descriptor = &color_animation_descriptor };
+
 // The LCD animation alternates between the layer name display and a
 // bitmap that displays all active layers
-static keyframe_animation_t lcd_animation = {
-    .num_frames = 2,
+static const keyframe_t lcd_keyframes[] = {
+    {MS2ST(2000), keyframe_display_layer_text},
+    {MS2ST(2000), keyframe_display_layer_bitmap},
+};
+
+static const keyframe_animation_descriptor_t lcd_animation_descriptor = {
+    KEYFRAMES(lcd_keyframes),
     .loop = true,
-    .frame_lengths = {MS2ST(2000), MS2ST(2000)},
-    .frame_functions = {keyframe_display_layer_text, keyframe_display_layer_bitmap},
 };
 
+static keyframe_animation_t lcd_animation = { .descriptor = &lcd_animation_descriptor };
+
+// Fades out the backlight and turns off the display when suspending
+static const keyframe_t suspend_keyframes[] = {
+    {0, keyframe_display_layer_text},
+    {MS2ST(1000), keyframe_animate_backlight_color},
+    {0, keyframe_disable_lcd_and_backlight},
+};
+
+static const keyframe_animation_descriptor_t suspend_animation_descriptor = {
+    KEYFRAMES(suspend_keyframes),
+    .loop = false,
+};
+
+static keyframe_animation_t suspend_animation = { .descriptor = &suspend_animation_descriptor };
+
+// Plays the startup animation again when resuming
+static const keyframe_t resume_keyframes[] = {
+    {0, keyframe_enable_lcd_and_backlight},
+    {0, display_welcome},
+    {MS2ST(1000), keyframe_animate_backlight_color},
+    {MS2ST(5000), keyframe_no_operation},
+    {0, enable_visualization},
+};
+
+static const keyframe_animation_descriptor_t resume_animation_descriptor = {
+    KEYFRAMES(resume_keyframes),
+    .loop = false,
+};
+
+static keyframe_animation_t resume_animation = { .descriptor = &resume_animation_descriptor };
+
 void initialize_user_visualizer(visualizer_state_t* state) {
     // The brightness will be dynamically adjustable in the future
     // But for now, change it here.
@@ -97,7 +147,12 @@ void initialize_user_visualizer(visualizer_state_t* state) {
     start_keyframe_animation(&startup_animation);
 }
 
-void update_user_visualizer_state(visualizer_state_t* state) {
+void update_user_visualizer_state_changes(visualizer_state_t* state, const visualizer_status_change_t* change) {
+    // This visualizer only displays the layers, so there's nothing to do
+    // when for example only the leds change
+    if (!(change->changed & (VISUALIZER_CHANGED_LAYER | VISUALIZER_CHANGED_DEFAULT_LAYER))) {
+        return;
+    }
     // Add more tests, change the colors and layer texts here
     // Usually you want to check the high bits (higher layers first)
     // because that's the order layers are processed for keypresses
@@ -105,6 +160,7 @@ void update_user_visualizer_state(visualizer_state_t* state) {
     // state->status.layer
     // state->status.default_layer
     // state->status.leds (see led.h for available statuses)
+    uint32_t prev_target_color = state->target_lcd_color;
     if (state->status.layer & 0x2) {
         state->target_lcd_color = LCD_COLOR(0xA0, 0xB0, 0xFF);
         state->layer_text = "Layer 2";
@@ -117,5 +173,24 @@ void update_user_visualizer_state(visualizer_state_t* state) {
     // remember that you should normally have only one animation for the LCD
     // and one for the background. But you can also combine them if you want.
     start_keyframe_animation(&lcd_animation);
-    start_keyframe_animation(&color_animation);
+    // Don't restart the color animation if the color stays the same, so that
+    // a fade that is already running is not interrupted
+    if (state->target_lcd_color != prev_target_color) {
+        state->prev_lcd_color = state->current_lcd_color;
+        start_keyframe_animation(&color_animation);
+    }
+}
+
+void user_visualizer_suspend(visualizer_state_t* state) {
+    state->layer_text = "Suspending...";
+    uint8_t hue = LCD_HUE(state->current_lcd_color);
+    uint8_t sat = LCD_SAT(state->current_lcd_color);
+    state->target_lcd_color = LCD_COLOR(hue, sat, 0);
+    start_keyframe_animation(&suspend_animation);
+}
+
+void user_visualizer_resume(visualizer_state_t* state) {
+    state->current_lcd_color = LCD_COLOR(0x00, 0x00, 0x00);
+    state->target_lcd_color = LCD_COLOR(0x10, 0xFF, 0xFF);
+    start_keyframe_animation(&resume_animation);
 }
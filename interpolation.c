@@ -0,0 +1,187 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Fred Sundvik
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "interpolation.h"
+
+#define NUM_SEGMENTS 32
+#define SEGMENT_SHIFT 10
+#define SEGMENT_LENGTH (1 << SEGMENT_SHIFT)
+
+// The easing curves sampled at the start of each segment, and at the end, in
+// Q15. Values between the samples are interpolated linearly.
+// There's no table for the linear curve, so the tables are indexed by
+// CURVE(easing)
+#define CURVE(easing) ((easing) - EASING_IN)
+
+static const uint16_t easing_curves[NUM_EASINGS - EASING_IN][NUM_SEGMENTS + 1] = {
+    [CURVE(EASING_IN)] = {
+        0, 32, 128, 288, 512, 800, 1152, 1568,
+        2048, 2592, 3200, 3872, 4608, 5408, 6272, 7200,
+        8192, 9248, 10368, 11552, 12800, 14112, 15488, 16928,
+        18432, 20000, 21632, 23328, 25088, 26912, 28800, 30752,
+        32768,
+    },
+    [CURVE(EASING_OUT)] = {
+        0, 2016, 3968, 5856, 7680, 9440, 11136, 12768,
+        14336, 15840, 17280, 18656, 19968, 21216, 22400, 23520,
+        24576, 25568, 26496, 27360, 28160, 28896, 29568, 30176,
+        30720, 31200, 31616, 31968, 32256, 32480, 32640, 32736,
+        32768,
+    },
+    [CURVE(EASING_IN_OUT)] = {
+        0, 4, 32, 108, 256, 500, 864, 1372,
+        2048, 2916, 4000, 5324, 6912, 8788, 10976, 13500,
+        16384, 19268, 21792, 23980, 25856, 27444, 28768, 29852,
+        30720, 31396, 31904, 32268, 32512, 32660, 32736, 32764,
+        32768,
+    },
+    [CURVE(EASING_SMOOTHSTEP)] = {
+        0, 94, 368, 810, 1408, 2150, 3024, 4018,
+        5120, 6318, 7600, 8954, 10368, 11830, 13328, 14850,
+        16384, 17918, 19440, 20938, 22400, 23814, 25168, 26450,
+        27648, 28750, 29744, 30618, 31360, 31958, 32400, 32674,
+        32768,
+    },
+};
+
+// The inverse slope of each segment of the curves above, in Q16, so that
+// the progress can be converted back to time without dividing.
+// Calculated as (SEGMENT_LENGTH << 16) / (curve[i + 1] - curve[i]).
+static const uint32_t easing_inverse_slopes[NUM_EASINGS - EASING_IN][NUM_SEGMENTS] = {
+    [CURVE(EASING_IN)] = {
+        2097152, 699050, 419430, 299593, 233016, 190650, 161319, 139810,
+        123361, 110376, 99864, 91180, 83886, 77672, 72315, 67650,
+        63550, 59918, 56679, 53773, 51150, 48770, 46603, 44620,
+        42799, 41120, 39568, 38130, 36792, 35544, 34379, 33288,
+    },
+    [CURVE(EASING_OUT)] = {
+        33288, 34379, 35544, 36792, 38130, 39568, 41120, 42799,
+        44620, 46603, 48770, 51150, 53773, 56679, 59918, 63550,
+        67650, 72315, 77672, 83886, 91180, 99864, 110376, 123361,
+        139810, 161319, 190650, 233016, 299593, 419430, 699050, 2097152,
+    },
+    [CURVE(EASING_IN_OUT)] = {
+        16777216, 2396745, 883011, 453438, 275036, 184365, 132104, 99273,
+        77314, 61908, 50686, 42259, 35772, 30671, 26588, 23269,
+        23269, 26588, 30671, 35772, 42259, 50686, 61908, 77314,
+        99273, 132104, 184365, 275036, 453438, 883011, 2396745, 16777216,
+    },
+    [CURVE(EASING_SMOOTHSTEP)] = {
+        713924, 244922, 151830, 112222, 90443, 76783, 67513, 60897,
+        56017, 52347, 49563, 47460, 45902, 44798, 44092, 43747,
+        43747, 44092, 44798, 45902, 47460, 49563, 52347, 56017,
+        60897, 67513, 76783, 90443, 112222, 151830, 244922, 713924,
+    },
+};
+
+static uint32_t ease(easing_t easing, uint32_t linear) {
+    if (easing == EASING_LINEAR || linear >= INTERPOLATION_ONE) {
+        return linear;
+    }
+    const uint16_t* curve = easing_curves[CURVE(easing)];
+    uint32_t segment = linear >> SEGMENT_SHIFT;
+    uint32_t offset = linear & (SEGMENT_LENGTH - 1);
+    return curve[segment] + (((curve[segment + 1] - curve[segment]) * offset) >> SEGMENT_SHIFT);
+}
+
+// Returns the linear progress where the eased progress reaches the value.
+// Rounded up, but since the inverse slopes are rounded down, it's never
+// after the real point.
+static uint32_t uneased(easing_t easing, uint32_t eased, uint32_t linear_start) {
+    if (easing == EASING_LINEAR) {
+        return eased;
+    }
+    const uint16_t* curve = easing_curves[CURVE(easing)];
+    // The result is usually in the same segment, or one of the next ones
+    uint32_t segment = linear_start >> SEGMENT_SHIFT;
+    while (segment < NUM_SEGMENTS - 1 && curve[segment + 1] <= eased) {
+        segment++;
+    }
+    return (segment << SEGMENT_SHIFT) +
+        (((eased - curve[segment]) * easing_inverse_slopes[CURVE(easing)][segment] + 0xFFFF) >> 16);
+}
+
+void interpolation_init(interpolation_t* interpolation, easing_t easing, uint32_t length) {
+    interpolation->easing = easing;
+    interpolation->length = length;
+    // Rounded down, the progress jumps to the end at the end of the frame
+    interpolation->step = length ? ((uint32_t)INTERPOLATION_ONE << 16) / length : 0;
+}
+
+static uint32_t linear_progress(const interpolation_t* interpolation, uint32_t time) {
+    if (time >= interpolation->length) {
+        return INTERPOLATION_ONE;
+    }
+    return (time * interpolation->step) >> 16;
+}
+
+uint32_t interpolation_progress(const interpolation_t* interpolation, uint32_t time) {
+    return ease(interpolation->easing, linear_progress(interpolation, time));
+}
+
+void interpolated_value_init(interpolated_value_t* value, int32_t start, int32_t end) {
+    value->start = start;
+    value->delta = end - start;
+    uint32_t distance = value->delta < 0 ? -value->delta : value->delta;
+    // Rounded down, which makes the change times early rather than late
+    value->progress_per_unit = distance ? ((uint32_t)INTERPOLATION_ONE << 16) / distance : 0;
+}
+
+static uint32_t distance_at(const interpolated_value_t* value, uint32_t progress) {
+    uint32_t distance = value->delta < 0 ? -value->delta : value->delta;
+    return (distance * progress) >> 15;
+}
+
+int32_t interpolated_value_get(const interpolated_value_t* value, uint32_t progress) {
+    int32_t distance = distance_at(value, progress);
+    return value->delta < 0 ? value->start - distance : value->start + distance;
+}
+
+uint32_t interpolated_value_next_change(const interpolated_value_t* value,
+        const interpolation_t* interpolation, uint32_t time) {
+    uint32_t length = interpolation->length;
+    if (value->delta == 0 || time >= length) {
+        return length;
+    }
+    uint32_t linear = linear_progress(interpolation, time);
+    uint32_t distance = value->delta < 0 ? -value->delta : value->delta;
+    uint32_t next_distance = distance_at(value, ease(interpolation->easing, linear)) + 1;
+    if (next_distance > distance) {
+        return length;
+    }
+    uint32_t eased = (next_distance * value->progress_per_unit + 0xFFFF) >> 16;
+    uint32_t next_linear = uneased(interpolation->easing, eased, linear);
+    // The rounding can put the change of a large value past the end
+    if (next_linear >= INTERPOLATION_ONE) {
+        return length;
+    }
+    uint32_t next_time;
+    if (length <= INTERPOLATION_MAX_FAST_LENGTH) {
+        next_time = (next_linear * length + INTERPOLATION_ONE - 1) >> 15;
+    }
+    else {
+        next_time = ((uint64_t)next_linear * length + INTERPOLATION_ONE - 1) >> 15;
+    }
+    return next_time > time ? next_time : time + 1;
+}
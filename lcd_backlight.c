@@ -23,7 +23,9 @@ SOFTWARE.
 */
 
 #include "lcd_backlight.h"
+#ifndef LCD_BACKLIGHT_FIXED_POINT
 #include <math.h>
+#endif
 
 static uint8_t current_hue = 0x00;
 static uint8_t current_saturation = 0x00;
@@ -35,6 +37,7 @@ void lcd_backlight_init(void) {
     lcd_backlight_color(current_hue, current_saturation, current_intensity);
 }
 
+#ifndef LCD_BACKLIGHT_FIXED_POINT
 // This code is based on Brian Neltner's blogpost and example code
 // "Why every LED light should be using HSI colorspace".
 // http://blog.saikoled.com/post/43693602826/why-every-led-light-should-be-using-hsi
@@ -66,13 +69,112 @@ static void hsi_to_rgb(float h, float s, float i, uint16_t* r_out, uint16_t* g_o
     *b_out = b > 65535 ? 65535 : b;
 }
 
-void lcd_backlight_color(uint8_t hue, uint8_t saturation, uint8_t intensity) {
-    uint16_t r, g, b;
+#else
+
+// The ratio cos(h) / cos(60 - h) for all hue values, in Q15 format. The
+// angle h is measured from the start of the 120 degree sector of the hue,
+// and the values are calculated exactly like the floating point version does
+static const int32_t hsi_cos_ratio[256] = {
+    65536, 62853, 60378, 58085, 55953, 53962, 52097, 50345,
+    48693, 47130, 45650, 44242, 42901, 41621, 40395, 39220,
+    38090, 37002, 35952, 34937, 33955, 33002, 32076, 31175,
+    30297, 29440, 28602, 27782, 26977, 26188, 25412, 24648,
+    23894, 23151, 22416, 21689, 20968, 20254, 19544, 18837,
+    18134, 17433, 16734, 16034, 15335, 14634, 13931, 13225,
+    12515, 11800, 11079, 10352, 9617, 8874, 8121, 7356,
+    6580, 5791, 4986, 4166, 3328, 2471, 1593, 692,
+    -234, -1187, -2169, -3184, -4234, -5322, -6452, -7627,
+    -8853, -10133, -11474, -12882, -14362, -15925, -17577, -19329,
+    -21194, -23185, -25317, -27610, -30085, 65536, 62853, 60378,
+    58085, 55953, 53962, 52097, 50345, 48692, 47130, 45649,
+    44242, 42901, 41621, 40395, 39219, 38090, 37002, 35952,
+    34937, 33955, 33002, 32076, 31175, 30297, 29440, 28602,
+    27782, 26977, 26188, 25412, 24647, 23894, 23151, 22416,
+    21689, 20968, 20253, 19543, 18837, 18134, 17433, 16734,
+    16034, 15335, 14634, 13931, 13224, 12514, 11800, 11079,
+    10352, 9617, 8874, 8120, 7356, 6580, 5790, 4986,
+    4166, 3328, 2471, 1593, 692, -234, -1187, -2169,
+    -3184, -4234, -5322, -6452, -7627, -8853, -10133, -11474,
+    -12882, -14363, -15925, -17577, -19330, -21195, -23185, -25318,
+    -27610, -30085, -32768, 62853, 60378, 58086, 55953, 53962,
+    52098, 50345, 48693, 47130, 45650, 44242, 42901, 41621,
+    40395, 39220, 38090, 37002, 35952, 34937, 33955, 33002,
+    32076, 31175, 30297, 29440, 28602, 27782, 26977, 26188,
+    25412, 24648, 23894, 23151, 22416, 21689, 20968, 20254,
+    19544, 18837, 18134, 17433, 16734, 16034, 15335, 14634,
+    13931, 13225, 12515, 11800, 11079, 10352, 9617, 8874,
+    8121, 7356, 6580, 5791, 4986, 4166, 3328, 2471,
+    1593, 692, -234, -1187, -2169, -3184, -4234, -5322,
+    -6452, -7627, -8853, -10133, -11474, -12882, -14362, -15925,
+    -17577, -19329, -21194, -23185, -25317, -27610, -30085, 65536
+};
+
+// Integer only version of hsi_to_rgb, the intensity is the product of the
+// 8-bit intensity and brightness. The result differs from the floating point
+// version by at most 3 (out of 65535), and no intermediate result overflows
+// 32 bits. There are no divisions, they are multiplications by Q15
+// reciprocals, since the Cortex-M0 has no divide instruction and the
+// Cortex-M3 and M4 one takes up to 12 cycles.
+static void hsi_to_rgb(uint8_t hue, uint8_t saturation, uint32_t intensity, uint16_t* r_out, uint16_t* g_out, uint16_t* b_out) {
+    // 65535 * i / 3 with i = intensity / (255 * 255), with one extra bit of
+    // precision. Note that 65535 / (255 * 255) = 257 / 255, and that
+    // 22017 = 2^15 * 257 * 2 / 765, rounded
+    uint32_t x = (intensity * 22017u) >> 15;
+    // The saturation in Q15, 32897 = 2^23 / 255, rounded up so that 255
+    // becomes exactly 1
+    uint32_t s = (saturation * 32897u) >> 8;
+    int32_t ratio = hsi_cos_ratio[hue];
+    // The ratio is between -1 and 2, so the factors are non-negative. The
+    // ratio is offset by one for the multiplication so that it fits in 32
+    // unsigned bits, and the factors are shifted down to Q14 to make room
+    // for the next one.
+    uint32_t f1 = (32768u + ((s * (uint32_t)(ratio + 32768)) >> 15) - s) >> 1;
+    uint32_t f2 = (32768u + ((s * (uint32_t)(65536 - ratio)) >> 15) - s) >> 1;
+    uint32_t c1 = (x * f1) >> 15;
+    uint32_t c2 = (x * f2) >> 15;
+    uint32_t c3 = (x * (32768u - s)) >> 16;
+    c1 = c1 > 65535 ? 65535 : c1;
+    c2 = c2 > 65535 ? 65535 : c2;
+
+    // The sector limits match the rounding of the floating point version,
+    // where 255 wraps around to 360 degrees, which is the same as 0
+    if (hue < 85 || hue == 255) {
+        *r_out = c1;
+        *g_out = c2;
+        *b_out = c3;
+    } else if (hue < 171) {
+        *g_out = c1;
+        *b_out = c2;
+        *r_out = c3;
+    } else {
+        *b_out = c1;
+        *r_out = c2;
+        *g_out = c3;
+    }
+}
+#endif
+
+static void color_to_rgb(uint8_t hue, uint8_t saturation, uint8_t intensity, uint16_t* r, uint16_t* g, uint16_t* b) {
+#ifndef LCD_BACKLIGHT_FIXED_POINT
     float hue_f = 360.0f * (float)hue / 255.0f;
     float saturation_f = (float)saturation / 255.0f;
     float intensity_f = (float)intensity / 255.0f;
     intensity_f *= (float)current_brightness / 255.0f;
-    hsi_to_rgb(hue_f, saturation_f, intensity_f, &r, &g, &b);
+    hsi_to_rgb(hue_f, saturation_f, intensity_f, r, g, b);
+#else
+    hsi_to_rgb(hue, saturation, (uint32_t)intensity * current_brightness, r, g, b);
+#endif
+}
+
+#ifdef LCD_BACKLIGHT_WAVEFORM
+void lcd_backlight_color_to_rgb(uint8_t hue, uint8_t saturation, uint8_t intensity, lcd_backlight_rgb_t* rgb) {
+    color_to_rgb(hue, saturation, intensity, &rgb->r, &rgb->g, &rgb->b);
+}
+#endif
+
+void lcd_backlight_color(uint8_t hue, uint8_t saturation, uint8_t intensity) {
+    uint16_t r, g, b;
+    color_to_rgb(hue, saturation, intensity, &r, &g, &b);
 	current_hue = hue;
 	current_saturation = saturation;
 	current_intensity = intensity;
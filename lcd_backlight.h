@@ -37,6 +37,27 @@ void lcd_backlight_color(uint8_t hue, uint8_t saturation, uint8_t intensity);
 void lcd_backlight_brightness(uint8_t b);
 
 void lcd_backlight_hal_init(void);
+// Writing a color also stops the waveform playback
 void lcd_backlight_hal_color(uint16_t r, uint16_t g, uint16_t b);
 
+#ifdef LCD_BACKLIGHT_WAVEFORM
+typedef struct {
+    uint16_t r;
+    uint16_t g;
+    uint16_t b;
+} lcd_backlight_rgb_t;
+
+// Converts the color exactly like lcd_backlight_color, including the
+// brightness, but doesn't write it
+void lcd_backlight_color_to_rgb(uint8_t hue, uint8_t saturation, uint8_t intensity, lcd_backlight_rgb_t* rgb);
+
+// Writes the values to the PWM channels one at a time, the first one after
+// period_ms milliseconds, and the rest with the same interval, without
+// waking up the visualizer thread. The last value stays on. On the hardware
+// this is a timer interrupt or a timer triggered DMA transfer. The values
+// have to stay valid until the playback is finished, or stopped by
+// lcd_backlight_hal_color or another call to this function.
+void lcd_backlight_hal_play(const lcd_backlight_rgb_t* values, uint16_t count, uint16_t period_ms);
+#endif
+
 #endif /* LCD_BACKLIGHT_H_ */
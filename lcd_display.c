@@ -0,0 +1,860 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Fred Sundvik
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "lcd_display.h"
+#include <string.h>
+#if LCD_ASYNC_FLUSH
+#include "ch.h"
+#endif
+
+#define NUM_PAGES (LCD_DISPLAY_MAX_HEIGHT / LCD_DISPLAY_PAGE_HEIGHT)
+
+// Drivers with a fixed size are checked at compile time, the others when the
+// first frame is drawn
+#if defined(GDISP_SCREEN_HEIGHT) && GDISP_SCREEN_HEIGHT > LCD_DISPLAY_MAX_HEIGHT
+#error "The display is taller than LCD_DISPLAY_MAX_HEIGHT"
+#endif
+
+typedef struct {
+    bool used;
+    // Set when the line was partially erased, so it has to be fully redrawn
+    bool damaged;
+    coord_t x;
+    coord_t y;
+    font_t font;
+    char text[LCD_DISPLAY_MAX_LINE_LENGTH + 1];
+} text_line_t;
+
+// What is currently on the screen
+static text_line_t screen_lines[LCD_DISPLAY_MAX_LINES];
+// The frame that is being built
+static text_line_t frame_lines[LCD_DISPLAY_MAX_LINES];
+static bool screen_valid = false;
+static bool height_checked = false;
+// The lines of the frame that have already been drawn, when they are damaged
+// they are drawn again at the end of the frame
+static int drawn_frame_lines = 0;
+
+// The dirty columns of each page, the page is clean when start >= end
+static coord_t dirty_start[NUM_PAGES];
+static coord_t dirty_end[NUM_PAGES];
+
+#if LCD_ASYNC_FLUSH
+// Set while the driver is sending the front buffer, cleared by the interrupt.
+// Both flags are protected by the system lock
+static bool flush_busy = false;
+// Set when the completion should be signalled to flush_thread
+static bool flush_notify = false;
+// Set when a flush was skipped because the previous one was still in progress
+static bool flush_deferred = false;
+static thread_t* flush_thread = NULL;
+#endif
+
+#if LCD_PACKED_FRAMEBUFFER
+#if LCD_DISPLAY_PAGE_HEIGHT != 8
+#error "LCD_PACKED_FRAMEBUFFER needs a page height of 8"
+#endif
+
+// The framebuffer of the display driver, see LCD_PACKED_FRAMEBUFFER
+static uint8_t* framebuffer = NULL;
+
+static void fill_area(coord_t x, coord_t y, coord_t cx, coord_t cy, color_t color) {
+    coord_t width = gdispGetWidth();
+    coord_t height = gdispGetHeight();
+    coord_t x2 = x + cx;
+    coord_t y2 = y + cy;
+    x = x < 0 ? 0 : x;
+    y = y < 0 ? 0 : y;
+    x2 = x2 > width ? width : x2;
+    y2 = y2 > height ? height : y2;
+    if (x >= x2 || y >= y2) {
+        return;
+    }
+    LCD_DISPLAY_FRAMEBUFFER_WRITE(x, y, x2 - x, y2 - y);
+    for (coord_t page = y / 8; page * 8 < y2; page++) {
+        uint8_t mask = 0xFF;
+        if (y > page * 8) {
+            mask &= 0xFF << (y - page * 8);
+        }
+        if (y2 < page * 8 + 8) {
+            mask &= 0xFF >> (page * 8 + 8 - y2);
+        }
+        uint8_t* p = &framebuffer[page * width + x];
+        if (mask == 0xFF) {
+            memset(p, color == White ? 0x00 : 0xFF, x2 - x);
+        }
+        else if (color == White) {
+            for (coord_t i = 0; i < x2 - x; i++) {
+                p[i] &= ~mask;
+            }
+        }
+        else {
+            for (coord_t i = 0; i < x2 - x; i++) {
+                p[i] |= mask;
+            }
+        }
+    }
+}
+
+// Called by mcufont for each horizontal run of pixels in a glyph
+static void draw_pixels(int16_t x, int16_t y, uint8_t count, uint8_t alpha, void* state) {
+    (void)state;
+    coord_t width = gdispGetWidth();
+    if (alpha < 0x80 || y < 0 || y >= gdispGetHeight()) {
+        return;
+    }
+    uint8_t bit = 1 << (y % 8);
+    uint8_t* p = &framebuffer[(y / 8) * width];
+    LCD_DISPLAY_FRAMEBUFFER_WRITE(x, y, count, 1);
+    for (int16_t i = x < 0 ? 0 : x; i < x + count && i < width; i++) {
+        p[i] |= bit;
+    }
+}
+
+#if LCD_GLYPH_CACHE_SIZE > 0
+#define FIRST_CACHED_GLYPH ' '
+#define LAST_CACHED_GLYPH '~'
+#define NUM_CACHED_GLYPHS (LAST_CACHED_GLYPH - FIRST_CACHED_GLYPH + 1)
+// The glyph and the shift to the page have to fit in 32 bits
+#define MAX_CACHED_GLYPH_HEIGHT 24
+
+typedef struct glyph_font {
+    font_t font;
+    uint8_t width;
+    uint8_t height;
+    uint8_t bytes_per_column;
+    // The columns of all glyphs, each column is bytes_per_column bytes with
+    // the top row in the least significant bit. NULL if the font can't be
+    // cached
+    uint8_t* columns;
+} glyph_font_t;
+
+static uint8_t glyph_cache[LCD_GLYPH_CACHE_SIZE];
+static size_t glyph_cache_used = 0;
+static glyph_font_t glyph_fonts[LCD_GLYPH_CACHE_MAX_FONTS];
+static int num_glyph_fonts = 0;
+
+static void render_glyph_pixels(int16_t x, int16_t y, uint8_t count, uint8_t alpha, void* state) {
+    glyph_font_t* gf = state;
+    if (alpha < 0x80 || y < 0 || y >= gf->height) {
+        return;
+    }
+    for (int16_t i = x < 0 ? 0 : x; i < x + count && i < gf->width; i++) {
+        gf->columns[i * gf->bytes_per_column + y / 8] |= 1 << (y % 8);
+    }
+}
+
+static glyph_font_t* find_glyph_font(font_t font) {
+    for (int i = 0; i < num_glyph_fonts; i++) {
+        if (glyph_fonts[i].font == font) {
+            return glyph_fonts[i].columns ? &glyph_fonts[i] : NULL;
+        }
+    }
+    if (num_glyph_fonts == LCD_GLYPH_CACHE_MAX_FONTS) {
+        return NULL;
+    }
+    glyph_font_t* gf = &glyph_fonts[num_glyph_fonts++];
+    gf->font = font;
+    gf->width = gdispGetFontMetric(font, fontMaxWidth);
+    gf->height = gdispGetFontMetric(font, fontHeight);
+    gf->bytes_per_column = (gf->height + 7) / 8;
+    gf->columns = NULL;
+    size_t glyph_size = gf->width * gf->bytes_per_column;
+    size_t size = NUM_CACHED_GLYPHS * glyph_size;
+    if (gdispGetFontMetric(font, fontMinWidth) != gf->width ||
+            gf->height > MAX_CACHED_GLYPH_HEIGHT ||
+            glyph_cache_used + size > sizeof(glyph_cache)) {
+        return NULL;
+    }
+    uint8_t* columns = &glyph_cache[glyph_cache_used];
+    glyph_cache_used += size;
+    memset(columns, 0, size);
+    for (int c = FIRST_CACHED_GLYPH; c <= LAST_CACHED_GLYPH; c++) {
+        gf->columns = columns + (c - FIRST_CACHED_GLYPH) * glyph_size;
+        mf_render_character(font, 0, 0, c, render_glyph_pixels, gf);
+    }
+    gf->columns = columns;
+    return gf;
+}
+
+// Copies a glyph to the framebuffer, when erase is set the rest of the cell
+// is cleared, otherwise the glyph is drawn on top of what is there. Returns
+// false if the glyph has to be drawn normally.
+static bool blit_glyph(glyph_font_t* gf, coord_t x, coord_t y, uint16_t c, bool erase) {
+    coord_t width = gdispGetWidth();
+    if (c < FIRST_CACHED_GLYPH || c > LAST_CACHED_GLYPH ||
+            x < 0 || y < 0 || x + gf->width > width || y + gf->height > gdispGetHeight()) {
+        return false;
+    }
+    const uint8_t* src = &gf->columns[(c - FIRST_CACHED_GLYPH) * gf->width * gf->bytes_per_column];
+    unsigned shift = y % 8;
+    uint32_t cell = erase ? (((uint32_t)1 << gf->height) - 1) << shift : 0;
+    uint8_t* dst = &framebuffer[(y / 8) * width + x];
+    LCD_DISPLAY_FRAMEBUFFER_WRITE(x, y, gf->width, gf->height);
+    if (gf->bytes_per_column == 1) {
+        // The common case of a font at most 8 pixels high, that covers at
+        // most two pages. The stores can alias anything, so the loop works
+        // only on local copies
+        int columns = gf->width;
+        uint8_t mask0 = cell;
+        uint8_t mask1 = cell >> 8;
+        uint8_t* dst1 = dst + width;
+        if (shift + gf->height <= 8) {
+            for (int col = 0; col < columns; col++) {
+                dst[col] = (dst[col] & ~mask0) | (uint8_t)(src[col] << shift);
+            }
+        }
+        else {
+            for (int col = 0; col < columns; col++) {
+                uint16_t bits = src[col] << shift;
+                dst[col] = (dst[col] & ~mask0) | (uint8_t)bits;
+                dst1[col] = (dst1[col] & ~mask1) | (uint8_t)(bits >> 8);
+            }
+        }
+        return true;
+    }
+    int columns = gf->width;
+    int bytes_per_column = gf->bytes_per_column;
+    unsigned num_pages = (shift + gf->height + 7) / 8;
+    for (int col = 0; col < columns; col++) {
+        uint32_t bits = 0;
+        for (int i = 0; i < bytes_per_column; i++) {
+            bits |= (uint32_t)*src++ << (i * 8);
+        }
+        bits <<= shift;
+        uint8_t* p = dst + col;
+        for (unsigned page = 0; page < num_pages; page++, p += width) {
+            uint8_t mask = cell >> (page * 8);
+            *p = (*p & ~mask) | (uint8_t)(bits >> (page * 8));
+        }
+    }
+    return true;
+}
+#else
+typedef struct glyph_font glyph_font_t;
+
+static glyph_font_t* find_glyph_font(font_t font) {
+    (void)font;
+    return NULL;
+}
+
+static bool blit_glyph(glyph_font_t* gf, coord_t x, coord_t y, uint16_t c, bool erase) {
+    (void)gf;
+    (void)x;
+    (void)y;
+    (void)c;
+    (void)erase;
+    return false;
+}
+#endif
+
+// Draws a glyph of a monospaced font, when erase is set the cell is cleared
+// first
+static void draw_char(coord_t x, coord_t y, uint16_t c, font_t font, bool erase) {
+    glyph_font_t* gf = find_glyph_font(font);
+    if (gf && blit_glyph(gf, x, y, c, erase)) {
+        return;
+    }
+    if (erase) {
+        fill_area(x, y, gdispGetFontMetric(font, fontMaxWidth),
+                gdispGetFontMetric(font, fontHeight), White);
+    }
+    mf_render_character(font, x, y, c, draw_pixels, NULL);
+}
+
+static uint8_t draw_string_char(int16_t x, int16_t y, mf_char c, void* state) {
+    font_t* font = state;
+    return mf_render_character(*font, x, y, c, draw_pixels, NULL);
+}
+
+static void draw_string(coord_t x, coord_t y, const char* str, font_t font) {
+    if (gdispGetFontMetric(font, fontMinWidth) == gdispGetFontMetric(font, fontMaxWidth)) {
+        // The monospaced fonts are not kerned, so the glyphs can be drawn
+        // one at a time
+        glyph_font_t* gf = find_glyph_font(font);
+        coord_t w = gdispGetFontMetric(font, fontMaxWidth);
+        for (; *str; str++, x += w) {
+            if (gf == NULL || !blit_glyph(gf, x, y, (uint8_t)*str, false)) {
+                mf_render_character(font, x, y, (uint8_t)*str, draw_pixels, NULL);
+            }
+        }
+        return;
+    }
+    mf_render_aligned(font, x, y, MF_ALIGN_LEFT, str, 0, draw_string_char, &font);
+}
+
+static void clear_screen(void) {
+    framebuffer = gdispQuery(GDISP_QUERY_LCD_FRAMEBUFFER);
+    LCD_DISPLAY_FRAMEBUFFER_WRITE(0, 0, gdispGetWidth(), gdispGetHeight());
+    memset(framebuffer, 0, gdispGetWidth() * ((gdispGetHeight() + 7) / 8));
+}
+#else
+static void fill_area(coord_t x, coord_t y, coord_t cx, coord_t cy, color_t color) {
+    gdispFillArea(x, y, cx, cy, color);
+}
+
+// Draws a glyph of a monospaced font, when erase is set the cell is cleared
+// first
+static void draw_char(coord_t x, coord_t y, uint16_t c, font_t font, bool erase) {
+    if (erase) {
+        fill_area(x, y, gdispGetFontMetric(font, fontMaxWidth),
+                gdispGetFontMetric(font, fontHeight), White);
+    }
+    gdispDrawChar(x, y, c, font, Black);
+}
+
+static void draw_string(coord_t x, coord_t y, const char* str, font_t font) {
+    gdispDrawString(x, y, str, font, Black);
+}
+
+static void clear_screen(void) {
+    gdispClear(White);
+}
+#endif
+
+static bool intersects(coord_t x1, coord_t y1, coord_t cx1, coord_t cy1,
+        coord_t x2, coord_t y2, coord_t cx2, coord_t cy2) {
+    return x1 < x2 + cx2 && x2 < x1 + cx1 && y1 < y2 + cy2 && y2 < y1 + cy1;
+}
+
+static coord_t line_width(text_line_t* line) {
+    return gdispGetStringWidth(line->text, line->font);
+}
+
+static coord_t line_height(text_line_t* line) {
+    return gdispGetFontMetric(line->font, fontHeight);
+}
+
+// All the update functions take a draw parameter, when it's false only the
+// changed areas are marked dirty. That's used when the new frame has already
+// been restored from the cache.
+static void erase_area(coord_t x, coord_t y, coord_t cx, coord_t cy, bool draw) {
+    if (draw) {
+        fill_area(x, y, cx, cy, White);
+    }
+    lcd_display_mark_dirty(x, y, cx, cy);
+}
+
+// The other lines on the screen that overlap an erased area have to be fully
+// redrawn, and so do the lines of the frame that have already been drawn
+static void damage_lines(text_line_t* line, coord_t x, coord_t y, coord_t cx, coord_t cy) {
+    for (int i = 0; i < LCD_DISPLAY_MAX_LINES; i++) {
+        text_line_t* other = &screen_lines[i];
+        if (other->used && other != line &&
+                intersects(x, y, cx, cy, other->x, other->y, line_width(other), line_height(other))) {
+            other->damaged = true;
+        }
+    }
+    for (int i = 0; i < drawn_frame_lines; i++) {
+        text_line_t* other = &frame_lines[i];
+        if (other->used &&
+                intersects(x, y, cx, cy, other->x, other->y, line_width(other), line_height(other))) {
+            other->damaged = true;
+        }
+    }
+}
+
+static void erase_line(text_line_t* line, bool draw) {
+    coord_t cx = line_width(line);
+    coord_t cy = line_height(line);
+    erase_area(line->x, line->y, cx, cy, draw);
+    damage_lines(line, line->x, line->y, cx, cy);
+    line->used = false;
+}
+
+static void draw_line(text_line_t* line, bool draw) {
+    if (draw) {
+        draw_string(line->x, line->y, line->text, line->font);
+    }
+    lcd_display_mark_dirty(line->x, line->y, line_width(line), line_height(line));
+}
+
+// Draws only the glyphs that are different, works only for monospaced fonts
+static void update_monospaced_line(text_line_t* old_line, text_line_t* new_line, bool draw) {
+    coord_t w = gdispGetFontMetric(new_line->font, fontMaxWidth);
+    coord_t h = line_height(new_line);
+    size_t old_len = strlen(old_line->text);
+    size_t new_len = strlen(new_line->text);
+    size_t len = old_len > new_len ? old_len : new_len;
+    for (size_t i = 0; i < len; i++) {
+        if (i < old_len && i < new_len && old_line->text[i] == new_line->text[i]) {
+            continue;
+        }
+        coord_t x = new_line->x + i * w;
+        if (i < old_len) {
+            damage_lines(old_line, x, new_line->y, w, h);
+        }
+        if (draw && i < new_len) {
+            draw_char(x, new_line->y, (uint8_t)new_line->text[i], new_line->font, i < old_len);
+        }
+        else if (draw) {
+            fill_area(x, new_line->y, w, h, White);
+        }
+        lcd_display_mark_dirty(x, new_line->y, w, h);
+    }
+}
+
+static void update_line(text_line_t* old_line, text_line_t* new_line, bool draw) {
+    if (old_line == NULL) {
+        draw_line(new_line, draw);
+    }
+    else if (old_line->damaged) {
+        erase_line(old_line, draw);
+        draw_line(new_line, draw);
+    }
+    else if (gdispGetFontMetric(new_line->font, fontMinWidth) ==
+            gdispGetFontMetric(new_line->font, fontMaxWidth)) {
+        update_monospaced_line(old_line, new_line, draw);
+    }
+    else if (strcmp(old_line->text, new_line->text) != 0) {
+        erase_line(old_line, draw);
+        draw_line(new_line, draw);
+    }
+}
+
+static text_line_t* find_line(text_line_t* lines, text_line_t* line) {
+    for (int i = 0; i < LCD_DISPLAY_MAX_LINES; i++) {
+        if (lines[i].used && lines[i].x == line->x && lines[i].y == line->y &&
+                lines[i].font == line->font) {
+            return &lines[i];
+        }
+    }
+    return NULL;
+}
+
+static bool same_line(text_line_t* line1, text_line_t* line2) {
+    return line1->used == line2->used &&
+        (!line1->used ||
+         (line1->x == line2->x && line1->y == line2->y &&
+          line1->font == line2->font && strcmp(line1->text, line2->text) == 0));
+}
+
+#if LCD_FRAME_CACHE_SIZE > 0
+// The cached frames are stored in the format of the framebuffer
+#if LCD_PACKED_FRAMEBUFFER
+typedef uint8_t cache_pixel_t;
+#define FRAME_SIZE(width, height) ((width) * (((height) + 7) / 8))
+#else
+typedef pixel_t cache_pixel_t;
+#define FRAME_SIZE(width, height) ((width) * (height))
+#endif
+
+typedef struct {
+    bool used;
+    uint32_t last_used;
+    text_line_t lines[LCD_DISPLAY_MAX_LINES];
+    cache_pixel_t* pixels;
+} cache_entry_t;
+
+static cache_pixel_t cache_pixels[LCD_FRAME_CACHE_SIZE / sizeof(cache_pixel_t)];
+static cache_entry_t cache_entries[LCD_FRAME_CACHE_MAX_ENTRIES];
+static int num_cache_entries = -1;
+static uint32_t cache_use_counter = 0;
+static lcd_frame_cache_stats_t cache_stats;
+
+static void init_cache(void) {
+    size_t frame_size = FRAME_SIZE(gdispGetWidth(), gdispGetHeight());
+    num_cache_entries = (sizeof(cache_pixels) / sizeof(cache_pixel_t)) / frame_size;
+    if (num_cache_entries > LCD_FRAME_CACHE_MAX_ENTRIES) {
+        num_cache_entries = LCD_FRAME_CACHE_MAX_ENTRIES;
+    }
+    for (int i = 0; i < num_cache_entries; i++) {
+        cache_entries[i].used = false;
+        cache_entries[i].pixels = &cache_pixels[i * frame_size];
+    }
+    cache_stats.entries = num_cache_entries;
+}
+
+static cache_entry_t* find_cache_entry(void) {
+    for (int i = 0; i < num_cache_entries; i++) {
+        cache_entry_t* entry = &cache_entries[i];
+        if (!entry->used) {
+            continue;
+        }
+        bool same = true;
+        for (int j = 0; j < LCD_DISPLAY_MAX_LINES && same; j++) {
+            same = same_line(&entry->lines[j], &frame_lines[j]);
+        }
+        if (same) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+// Stores the screen in the least recently used entry
+static void store_cache_entry(void) {
+    cache_entry_t* entry = NULL;
+    for (int i = 0; i < num_cache_entries; i++) {
+        if (!cache_entries[i].used) {
+            entry = &cache_entries[i];
+            break;
+        }
+        if (entry == NULL || cache_entries[i].last_used < entry->last_used) {
+            entry = &cache_entries[i];
+        }
+    }
+    if (entry == NULL) {
+        return;
+    }
+    if (entry->used) {
+        cache_stats.evictions++;
+    }
+    entry->used = true;
+    entry->last_used = ++cache_use_counter;
+    memcpy(entry->lines, frame_lines, sizeof(frame_lines));
+    coord_t width = gdispGetWidth();
+    coord_t height = gdispGetHeight();
+#if LCD_PACKED_FRAMEBUFFER
+    memcpy(entry->pixels, framebuffer, FRAME_SIZE(width, height));
+#else
+    pixel_t* p = entry->pixels;
+    for (coord_t y = 0; y < height; y++) {
+        for (coord_t x = 0; x < width; x++) {
+            *p++ = gdispGetPixelColor(x, y);
+        }
+    }
+#endif
+}
+
+// Copies the dirty areas of the cached frame to the screen
+static void restore_cache_entry(cache_entry_t* entry) {
+    entry->last_used = ++cache_use_counter;
+    coord_t width = gdispGetWidth();
+    for (int page = 0; page < NUM_PAGES; page++) {
+        if (dirty_start[page] < dirty_end[page]) {
+#if LCD_PACKED_FRAMEBUFFER
+            size_t offset = page * width + dirty_start[page];
+            LCD_DISPLAY_FRAMEBUFFER_WRITE(dirty_start[page], page * LCD_DISPLAY_PAGE_HEIGHT,
+                    dirty_end[page] - dirty_start[page], LCD_DISPLAY_PAGE_HEIGHT);
+            memcpy(&framebuffer[offset], &entry->pixels[offset], dirty_end[page] - dirty_start[page]);
+#else
+            coord_t y = page * LCD_DISPLAY_PAGE_HEIGHT;
+            coord_t cy = LCD_DISPLAY_PAGE_HEIGHT;
+            if (y + cy > gdispGetHeight()) {
+                cy = gdispGetHeight() - y;
+            }
+            gdispBlitAreaEx(dirty_start[page], y, dirty_end[page] - dirty_start[page], cy,
+                    dirty_start[page], y, width, entry->pixels);
+#endif
+        }
+    }
+}
+
+void lcd_display_get_cache_stats(lcd_frame_cache_stats_t* stats) {
+    *stats = cache_stats;
+}
+#endif
+
+// The progress of the frame that lcd_display_end_frame_step is drawing
+typedef enum {
+    RENDER_IDLE,
+    RENDER_ERASE,
+    RENDER_UPDATE,
+    // Redraws the lines that were damaged after they were updated
+    RENDER_REPAIR,
+} render_phase_t;
+
+static struct {
+    render_phase_t phase;
+    int line;
+    bool draw;
+#if LCD_FRAME_CACHE_SIZE > 0
+    cache_entry_t* cache_entry;
+#endif
+} render = {.phase = RENDER_IDLE};
+
+void lcd_display_begin_frame(void) {
+    if (render.phase != RENDER_IDLE) {
+        // The unfinished frame is partly on the screen
+        render.phase = RENDER_IDLE;
+        screen_valid = false;
+    }
+    memset(frame_lines, 0, sizeof(frame_lines));
+}
+
+void lcd_display_draw_string(coord_t x, coord_t y, const char* str, font_t font) {
+    for (int i = 0; i < LCD_DISPLAY_MAX_LINES; i++) {
+        text_line_t* line = &frame_lines[i];
+        if (!line->used) {
+            line->used = true;
+            line->x = x;
+            line->y = y;
+            line->font = font;
+            strncpy(line->text, str ? str : "", LCD_DISPLAY_MAX_LINE_LENGTH);
+            line->text[LCD_DISPLAY_MAX_LINE_LENGTH] = 0;
+            return;
+        }
+    }
+}
+
+static void check_height(void) {
+    if (gdispGetHeight() > LCD_DISPLAY_MAX_HEIGHT) {
+        // The rows below would never be flushed
+        gfxHalt("The display is taller than LCD_DISPLAY_MAX_HEIGHT");
+    }
+    height_checked = true;
+}
+
+static void start_render(void) {
+    if (!height_checked) {
+        check_height();
+    }
+    if (!screen_valid) {
+        clear_screen();
+        lcd_display_mark_dirty(0, 0, gdispGetWidth(), gdispGetHeight());
+        memset(screen_lines, 0, sizeof(screen_lines));
+        screen_valid = true;
+    }
+    render.draw = true;
+#if LCD_FRAME_CACHE_SIZE > 0
+    if (num_cache_entries < 0) {
+        init_cache();
+    }
+    render.cache_entry = find_cache_entry();
+    if (render.cache_entry) {
+        cache_stats.hits++;
+        render.draw = false;
+    }
+    else {
+        cache_stats.misses++;
+    }
+#endif
+    render.phase = RENDER_ERASE;
+    render.line = 0;
+    drawn_frame_lines = 0;
+}
+
+static void finish_render(void) {
+    memcpy(screen_lines, frame_lines, sizeof(screen_lines));
+#if LCD_FRAME_CACHE_SIZE > 0
+    if (render.cache_entry) {
+        restore_cache_entry(render.cache_entry);
+    }
+    else {
+        store_cache_entry();
+    }
+#endif
+    render.phase = RENDER_IDLE;
+    lcd_display_flush();
+}
+
+bool lcd_display_end_frame_step(void) {
+    if (render.phase == RENDER_IDLE) {
+        start_render();
+    }
+    // Erase the old lines first, so that they don't overwrite the new ones
+    while (render.phase == RENDER_ERASE) {
+        if (render.line == LCD_DISPLAY_MAX_LINES) {
+            render.phase = RENDER_UPDATE;
+            render.line = 0;
+            break;
+        }
+        text_line_t* line = &screen_lines[render.line++];
+        if (line->used && find_line(frame_lines, line) == NULL) {
+            erase_line(line, render.draw);
+            return false;
+        }
+    }
+    while (render.phase == RENDER_UPDATE) {
+        if (render.line == LCD_DISPLAY_MAX_LINES) {
+            render.phase = RENDER_REPAIR;
+            render.line = 0;
+            break;
+        }
+        drawn_frame_lines = render.line;
+        text_line_t* line = &frame_lines[render.line++];
+        if (line->used) {
+            update_line(find_line(screen_lines, line), line, render.draw);
+            return false;
+        }
+    }
+    // The text of these lines is still there, only the erased parts are
+    // missing, so drawing them again is enough
+    while (render.line < LCD_DISPLAY_MAX_LINES) {
+        text_line_t* line = &frame_lines[render.line++];
+        if (line->used && line->damaged) {
+            line->damaged = false;
+            draw_line(line, render.draw);
+            return false;
+        }
+    }
+    finish_render();
+    return true;
+}
+
+void lcd_display_end_frame(void) {
+    while (!lcd_display_end_frame_step()) {
+    }
+}
+
+void lcd_display_invalidate(void) {
+    screen_valid = false;
+}
+
+void lcd_display_mark_dirty(coord_t x, coord_t y, coord_t cx, coord_t cy) {
+    coord_t width = gdispGetWidth();
+    coord_t height = gdispGetHeight();
+    // A taller display stops at the first frame, see check_height
+    if (height > LCD_DISPLAY_MAX_HEIGHT) {
+        height = LCD_DISPLAY_MAX_HEIGHT;
+    }
+    coord_t x2 = x + cx;
+    coord_t y2 = y + cy;
+    x = x < 0 ? 0 : x;
+    y = y < 0 ? 0 : y;
+    x2 = x2 > width ? width : x2;
+    y2 = y2 > height ? height : y2;
+    if (x >= x2 || y >= y2) {
+        return;
+    }
+    for (int page = y / LCD_DISPLAY_PAGE_HEIGHT; page <= (y2 - 1) / LCD_DISPLAY_PAGE_HEIGHT; page++) {
+        if (dirty_start[page] >= dirty_end[page]) {
+            dirty_start[page] = x;
+            dirty_end[page] = x2;
+        }
+        else {
+            dirty_start[page] = x < dirty_start[page] ? x : dirty_start[page];
+            dirty_end[page] = x2 > dirty_end[page] ? x2 : dirty_end[page];
+        }
+    }
+}
+
+#if LCD_ASYNC_FLUSH
+static bool is_dirty(void) {
+    for (int page = 0; page < NUM_PAGES; page++) {
+        if (dirty_start[page] < dirty_end[page]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void lcd_display_flush(void) {
+    if (!is_dirty()) {
+        return;
+    }
+    chSysLock();
+    if (flush_busy) {
+        // Overwriting the front buffer now would tear the frame that is being
+        // sent, so wait for the completion and send everything then
+        flush_thread = chThdGetSelfX();
+        flush_notify = true;
+        flush_deferred = true;
+        chSysUnlock();
+        return;
+    }
+    flush_busy = true;
+    chSysUnlock();
+    flush_deferred = false;
+    lcd_display_flush_t flush = {.num_areas = 0};
+#if LCD_PARTIAL_FLUSH
+    for (int page = 0; page < NUM_PAGES; page++) {
+        if (dirty_start[page] < dirty_end[page]) {
+            lcd_display_area_t* area = &flush.areas[flush.num_areas++];
+            area->x = dirty_start[page];
+            area->y = page * LCD_DISPLAY_PAGE_HEIGHT;
+            area->cx = dirty_end[page] - dirty_start[page];
+            area->cy = LCD_DISPLAY_PAGE_HEIGHT;
+        }
+    }
+#else
+    flush.num_areas = 1;
+    flush.areas[0].x = 0;
+    flush.areas[0].y = 0;
+    flush.areas[0].cx = gdispGetWidth();
+    flush.areas[0].cy = gdispGetHeight();
+#endif
+    gdispControl(GDISP_CONTROL_LCD_FLUSH_START, &flush);
+    memset(dirty_start, 0, sizeof(dirty_start));
+    memset(dirty_end, 0, sizeof(dirty_end));
+}
+
+bool lcd_display_flush_pending(void) {
+    // Half of a frame that is drawn in parts is not flushed
+    return flush_deferred && !flush_busy && render.phase == RENDER_IDLE;
+}
+
+static void wait_transfer(void) {
+    chSysLock();
+    while (flush_busy) {
+        flush_thread = chThdGetSelfX();
+        flush_notify = true;
+        chSysUnlock();
+        // An event signalled after the unlock stays pending until this wait
+        chEvtWaitOneTimeout(LCD_DISPLAY_FLUSH_EVENTS, TIME_INFINITE);
+        chSysLock();
+    }
+    chSysUnlock();
+}
+
+void lcd_display_wait_flush(void) {
+    wait_transfer();
+    if (flush_deferred) {
+        lcd_display_flush();
+        wait_transfer();
+    }
+}
+
+void lcd_display_flush_completeI(void) {
+    flush_busy = false;
+    if (flush_notify) {
+        flush_notify = false;
+        chEvtSignalI(flush_thread, LCD_DISPLAY_FLUSH_EVENTS);
+    }
+}
+#else
+void lcd_display_flush(void) {
+#if LCD_PARTIAL_FLUSH
+    for (int page = 0; page < NUM_PAGES; page++) {
+        if (dirty_start[page] < dirty_end[page]) {
+            lcd_display_area_t area = {
+                .x = dirty_start[page],
+                .y = page * LCD_DISPLAY_PAGE_HEIGHT,
+                .cx = dirty_end[page] - dirty_start[page],
+                .cy = LCD_DISPLAY_PAGE_HEIGHT,
+            };
+            gdispControl(GDISP_CONTROL_LCD_FLUSH_AREA, &area);
+        }
+    }
+#else
+    bool dirty = false;
+    for (int page = 0; page < NUM_PAGES; page++) {
+        dirty |= dirty_start[page] < dirty_end[page];
+    }
+    if (dirty) {
+        gdispFlush();
+    }
+#endif
+    memset(dirty_start, 0, sizeof(dirty_start));
+    memset(dirty_end, 0, sizeof(dirty_end));
+}
+
+bool lcd_display_flush_pending(void) {
+    return false;
+}
+
+void lcd_display_wait_flush(void) {
+}
+#endif
@@ -0,0 +1,199 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Fred Sundvik
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef LCD_DISPLAY_H_
+#define LCD_DISPLAY_H_
+#include "gfx.h"
+
+// Helpers for drawing black text on a white background, that keep track of
+// what is already on the screen. Only the glyphs that are different from the
+// previous frame are drawn, and only the changed parts of the screen are
+// flushed to the display.
+//
+// A frame is drawn like this
+//   lcd_display_begin_frame();
+//   lcd_display_draw_string(0, 0, "Hello", font);
+//   lcd_display_end_frame();
+// Text lines that were on the screen, but are not part of the new frame are
+// erased.
+
+// The screen is divided into pages of this many rows, the dirty areas are
+// tracked separately for each page. This matches how most monochrome LCD
+// controllers organize their memory
+#define LCD_DISPLAY_PAGE_HEIGHT 8
+
+// The dirty areas are tracked for this many rows, it can be defined in
+// gfxconf.h. A taller display stops the build when the driver defines
+// GDISP_SCREEN_HEIGHT, otherwise the first frame halts with gfxHalt.
+#ifndef LCD_DISPLAY_MAX_HEIGHT
+#define LCD_DISPLAY_MAX_HEIGHT 64
+#endif
+
+// The maximum number of text lines on the screen, and the maximum length of
+// a line, longer lines are truncated
+#ifndef LCD_DISPLAY_MAX_LINES
+#define LCD_DISPLAY_MAX_LINES 4
+#endif
+#ifndef LCD_DISPLAY_MAX_LINE_LENGTH
+#define LCD_DISPLAY_MAX_LINE_LENGTH 32
+#endif
+
+// Define LCD_PARTIAL_FLUSH to TRUE in gfxconf.h if the display driver handles
+// this control code. The value is a pointer to a lcd_display_area_t, and the
+// driver should send only that area to the display. Otherwise the whole
+// screen is flushed with gdispFlush, whenever something has changed.
+#define GDISP_CONTROL_LCD_FLUSH_AREA (GDISP_CONTROL_LLD + 0x100)
+
+#ifndef LCD_PARTIAL_FLUSH
+#define LCD_PARTIAL_FLUSH FALSE
+#endif
+
+// Define LCD_ASYNC_FLUSH to TRUE in gfxconf.h if the display driver can send
+// the frame in the background, for example with DMA. The uGFX framebuffer is
+// then the back buffer that the frames are drawn into, and the driver keeps a
+// front buffer that is being sent. The flush is started with this control
+// code, the value is a pointer to a lcd_display_flush_t. The driver copies the
+// areas to the front buffer, starts the transfer and returns immediately. When
+// the transfer is done, it calls lcd_display_flush_completeI from the
+// interrupt, inside a chSysLockFromISR block.
+//
+// The next frame is drawn while the previous one is sent. If it's finished
+// before that, the flush is deferred instead of overwriting the front buffer
+// in the middle of the transfer. The LCD_DISPLAY_FLUSH_EVENTS are signalled to
+// the drawing thread when the transfer completes, it should then call
+// lcd_display_flush again if lcd_display_flush_pending returns true.
+#define GDISP_CONTROL_LCD_FLUSH_START (GDISP_CONTROL_LLD + 0x101)
+
+#ifndef LCD_ASYNC_FLUSH
+#define LCD_ASYNC_FLUSH FALSE
+#endif
+
+// Define LCD_PACKED_FRAMEBUFFER to TRUE in gfxconf.h if the display driver
+// keeps its framebuffer in the format of the monochrome LCD controllers, and
+// returns a pointer to it from gdispQuery with this code. The framebuffer is
+// divided into pages of 8 rows, each byte is a column of 8 pixels with the
+// least significant bit at the top, and a set bit is a black pixel. The bytes
+// of page p start at p * width. The text is then drawn directly into the
+// framebuffer, and erasing and clearing are a few word writes per page.
+#define GDISP_QUERY_LCD_FRAMEBUFFER (GDISP_QUERY_LLD + 0x100)
+
+#ifndef LCD_PACKED_FRAMEBUFFER
+#define LCD_PACKED_FRAMEBUFFER FALSE
+#endif
+
+// Called with the area of the framebuffer that is about to be written
+// directly, it can be defined in gfxconf.h for profiling the drawing. The
+// writes through the uGFX functions are not included.
+#ifndef LCD_DISPLAY_FRAMEBUFFER_WRITE
+#define LCD_DISPLAY_FRAMEBUFFER_WRITE(x, y, cx, cy)
+#endif
+
+#ifndef LCD_DISPLAY_FLUSH_EVENTS
+#define LCD_DISPLAY_FLUSH_EVENTS EVENT_MASK(1)
+#endif
+
+// The number of bytes reserved for caching rendered frames, when a frame
+// with exactly the same text is drawn again, it's copied from the cache
+// instead of being rendered. Each frame needs width * height * sizeof(pixel_t)
+// bytes, and it also needs GDISP_NEED_PIXELREAD. With LCD_PACKED_FRAMEBUFFER
+// it's width * height / 8 bytes instead. Set to 0 to disable.
+#ifndef LCD_FRAME_CACHE_SIZE
+#define LCD_FRAME_CACHE_SIZE 0
+#endif
+#ifndef LCD_FRAME_CACHE_MAX_ENTRIES
+#define LCD_FRAME_CACHE_MAX_ENTRIES 4
+#endif
+
+// The number of bytes reserved for the pre-rendered glyphs of the monospaced
+// fonts, only used with LCD_PACKED_FRAMEBUFFER. The printable ASCII glyphs
+// of a font are rendered once, the first time it's used, and then copied to
+// the framebuffer a column at a time. Each font needs 95 * width *
+// ((height + 7) / 8) bytes, 570 for fixed_5x8. Fonts that are not
+// monospaced, taller than 24 pixels or that don't fit are drawn normally.
+#ifndef LCD_GLYPH_CACHE_SIZE
+#define LCD_GLYPH_CACHE_SIZE 0
+#endif
+#ifndef LCD_GLYPH_CACHE_MAX_FONTS
+#define LCD_GLYPH_CACHE_MAX_FONTS 2
+#endif
+
+typedef struct {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t evictions;
+    // The number of frames that fit in the cache
+    uint32_t entries;
+} lcd_frame_cache_stats_t;
+
+typedef struct {
+    coord_t x;
+    coord_t y;
+    coord_t cx;
+    coord_t cy;
+} lcd_display_area_t;
+
+#define LCD_DISPLAY_MAX_FLUSH_AREAS (LCD_DISPLAY_MAX_HEIGHT / LCD_DISPLAY_PAGE_HEIGHT)
+
+// The areas of an asynchronous flush, at most one per page. Without
+// LCD_PARTIAL_FLUSH there's always a single area covering the whole screen.
+typedef struct {
+    uint8_t num_areas;
+    lcd_display_area_t areas[LCD_DISPLAY_MAX_FLUSH_AREAS];
+} lcd_display_flush_t;
+
+void lcd_display_begin_frame(void);
+void lcd_display_draw_string(coord_t x, coord_t y, const char* str, font_t font);
+void lcd_display_end_frame(void);
+// Does the work of lcd_display_end_frame in parts, one text line at a time,
+// and returns true when the frame has been drawn and flushed. Nothing else
+// should be drawn in between, and if a new frame is begun before this one is
+// finished, that one is drawn from scratch.
+bool lcd_display_end_frame_step(void);
+
+// Call this if you draw directly with uGFX, so that the next frame is drawn
+// from scratch
+void lcd_display_invalidate(void);
+// Marks an area of the screen as changed, so that it's flushed at the end of
+// the frame
+void lcd_display_mark_dirty(coord_t x, coord_t y, coord_t cx, coord_t cy);
+// Flushes the changed areas to the display
+void lcd_display_flush(void);
+// Returns true when there are changes that couldn't be flushed because the
+// previous flush was still in progress, and that has now completed. Always
+// false without LCD_ASYNC_FLUSH
+bool lcd_display_flush_pending(void);
+// Waits until the display has received everything flushed so far, for
+// example before turning it off
+void lcd_display_wait_flush(void);
+#if LCD_ASYNC_FLUSH
+// Called by the display driver when the transfer started with
+// GDISP_CONTROL_LCD_FLUSH_START is done
+void lcd_display_flush_completeI(void);
+#endif
+
+#if LCD_FRAME_CACHE_SIZE > 0
+void lcd_display_get_cache_stats(lcd_frame_cache_stats_t* stats);
+#endif
+
+#endif /* LCD_DISPLAY_H_ */
@@ -0,0 +1,153 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Fred Sundvik
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// Checks that the integer only backlight color conversion, which is used
+// with LCD_BACKLIGHT_FIXED_POINT, stays within BACKLIGHT_MAX_ERROR of the
+// floating point one. lcd_backlight.c is compiled twice, the fixed point
+// build with its functions renamed, and both write to the HAL below. Also
+// checks the wakeups of a fade that is longer than
+// INTERPOLATION_MAX_FAST_LENGTH.
+
+#include "lcd_backlight.h"
+#include "interpolation.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// The bound that is documented for the fixed point hsi_to_rgb
+#define BACKLIGHT_MAX_ERROR 3
+
+void fixed_lcd_backlight_color(uint8_t hue, uint8_t saturation, uint8_t intensity);
+void fixed_lcd_backlight_brightness(uint8_t b);
+
+static uint16_t hal_rgb[3];
+
+void lcd_backlight_hal_init(void) {
+}
+
+void lcd_backlight_hal_color(uint16_t r, uint16_t g, uint16_t b) {
+    hal_rgb[0] = r;
+    hal_rgb[1] = g;
+    hal_rgb[2] = b;
+}
+
+// Every hue and saturation, with the intensities and brightnesses in steps of
+// BRIGHTNESS_STEP, and all intensities at the commonly used brightnesses
+#define BRIGHTNESS_STEP 5
+static const uint8_t full_brightnesses[] = {0x50, 0x7F, 0xFF};
+
+static bool is_full_brightness(unsigned brightness) {
+    for (unsigned i = 0; i < sizeof(full_brightnesses); i++) {
+        if (full_brightnesses[i] == brightness) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Two seconds with 100 kHz ticks
+#define LONG_FADE_LENGTH 200000
+// A fade wakes up once for each step of the value, and a few times more
+// because the times can be early by the length of one step of the progress
+#define LONG_FADE_MAX_WAKEUPS(distance) ((distance) * (LONG_FADE_LENGTH / INTERPOLATION_ONE + 2))
+
+// Follows a fade of a color channel over the whole frame, like the visualizer
+// does, and checks that it never wakes up after the value has changed, or
+// much more often than the value changes
+static bool check_long_fade(easing_t easing) {
+    interpolation_t interpolation;
+    interpolation_init(&interpolation, easing, LONG_FADE_LENGTH);
+    interpolated_value_t value;
+    interpolated_value_init(&value, 0, 255);
+    unsigned wakeups = 0;
+    uint32_t time = 0;
+    while (time < LONG_FADE_LENGTH) {
+        int32_t current = interpolated_value_get(&value, interpolation_progress(&interpolation, time));
+        uint32_t next = interpolated_value_next_change(&value, &interpolation, time);
+        for (uint32_t t = time + 1; t < next; t++) {
+            if (interpolated_value_get(&value, interpolation_progress(&interpolation, t)) != current) {
+                printf("FAIL: the long fade with easing %d changes at %u, but wakes up at %u\n",
+                        easing, t, next);
+                return false;
+            }
+        }
+        wakeups++;
+        time = next;
+    }
+    printf("long_fade_wakeups: easing %d %u\n", easing, wakeups);
+    if (wakeups > LONG_FADE_MAX_WAKEUPS(255)) {
+        printf("FAIL: the long fade with easing %d wakes up more than %d times\n", easing,
+                LONG_FADE_MAX_WAKEUPS(255));
+        return false;
+    }
+    return true;
+}
+
+int main(void) {
+    for (int easing = 0; easing < NUM_EASINGS; easing++) {
+        if (!check_long_fade(easing)) {
+            return 1;
+        }
+    }
+
+    int max_error = 0;
+    unsigned max_h = 0, max_s = 0, max_i = 0, max_b = 0;
+    unsigned long colors = 0;
+    for (unsigned b = 0; b <= 255; b++) {
+        bool full = is_full_brightness(b);
+        if (b % BRIGHTNESS_STEP != 0 && !full) {
+            continue;
+        }
+        lcd_backlight_brightness(b);
+        fixed_lcd_backlight_brightness(b);
+        for (unsigned i = 0; i <= 255; i += full ? 1 : BRIGHTNESS_STEP) {
+            for (unsigned s = 0; s <= 255; s++) {
+                for (unsigned h = 0; h <= 255; h++) {
+                    lcd_backlight_color(h, s, i);
+                    uint16_t expected[3] = {hal_rgb[0], hal_rgb[1], hal_rgb[2]};
+                    fixed_lcd_backlight_color(h, s, i);
+                    for (int c = 0; c < 3; c++) {
+                        int error = abs((int)hal_rgb[c] - (int)expected[c]);
+                        if (error > max_error) {
+                            max_error = error;
+                            max_h = h;
+                            max_s = s;
+                            max_i = i;
+                            max_b = b;
+                        }
+                    }
+                    colors++;
+                }
+            }
+        }
+    }
+    printf("backlight_colors_checked: %lu\n", colors);
+    printf("backlight_max_error: %d at hue %u saturation %u intensity %u brightness %u\n",
+            max_error, max_h, max_s, max_i, max_b);
+    if (max_error > BACKLIGHT_MAX_ERROR) {
+        printf("FAIL: the fixed point colors differ by more than %d\n", BACKLIGHT_MAX_ERROR);
+        return 1;
+    }
+    return 0;
+}
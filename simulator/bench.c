@@ -0,0 +1,272 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Fred Sundvik
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// Microbenchmarks of the visualizer hot paths. The visualizer and backlight
+// sources are included directly, so that their static functions can be
+// measured. Each benchmark prints one JSON object per line, with the median
+// and the best time per operation over a few runs.
+
+#include "simulator.h"
+#include "visualizer.c"
+#include "lcd_backlight.c"
+#include <string.h>
+#include <time.h>
+
+#define BENCH_RUNS 5
+// Each run takes roughly this long
+#define BENCH_RUN_TIME_NS 50000000ull
+
+typedef void (*bench_func_t)(uint32_t iterations);
+
+// Keeps the compiler from optimizing the benchmarked code away
+static volatile uint32_t sink;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static uint64_t time_run(bench_func_t func, uint32_t iterations) {
+    uint64_t start = now_ns();
+    func(iterations);
+    return now_ns() - start;
+}
+
+static int compare_double(const void* a, const void* b) {
+    double da = *(const double*)a;
+    double db = *(const double*)b;
+    return (da > db) - (da < db);
+}
+
+static void run_benchmark(const char* name, uint32_t param, bench_func_t func) {
+    // Find an iteration count that takes long enough to time reliably
+    uint32_t iterations = 1;
+    uint64_t elapsed;
+    while ((elapsed = time_run(func, iterations)) < BENCH_RUN_TIME_NS / 10) {
+        iterations *= 2;
+    }
+    iterations = iterations * (BENCH_RUN_TIME_NS / (double)elapsed) + 1;
+
+    double ns_per_op[BENCH_RUNS];
+    for (int i = 0; i < BENCH_RUNS; i++) {
+        ns_per_op[i] = (double)time_run(func, iterations) / iterations;
+    }
+    qsort(ns_per_op, BENCH_RUNS, sizeof(double), compare_double);
+    double median = ns_per_op[BENCH_RUNS / 2];
+    printf("{\"benchmark\": \"%s\", \"param\": %u, \"iterations\": %u, "
+            "\"ns_per_op\": %.2f, \"ns_per_op_min\": %.2f, \"ops_per_sec\": %.0f}\n",
+            name, param, iterations, median, ns_per_op[0], 1e9 / median);
+    fflush(stdout);
+}
+
+static void bench_hsi_to_rgb(uint32_t iterations) {
+    uint16_t r, g, b;
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < iterations; i++) {
+        uint8_t hue = i;
+        uint8_t saturation = i >> 8 | 0x80;
+        uint8_t intensity = i * 7;
+#ifdef LCD_BACKLIGHT_FIXED_POINT
+        hsi_to_rgb(hue, saturation, intensity * current_brightness, &r, &g, &b);
+#else
+        hsi_to_rgb(360.0f * hue / 255.0f, saturation / 255.0f, intensity / 255.0f, &r, &g, &b);
+#endif
+        sum += r + g + b;
+    }
+    sink = sum;
+}
+
+static void bench_lcd_backlight_color(uint32_t iterations) {
+    for (uint32_t i = 0; i < iterations; i++) {
+        lcd_backlight_color(i, i >> 8 | 0x80, i * 7);
+    }
+}
+
+static void bench_same_status(uint32_t iterations) {
+    visualizer_keyboard_status_t statuses[4] = {
+        { .layer = 1, .default_layer = 1 },
+        { .layer = 1, .default_layer = 1 },
+        { .layer = 3, .default_layer = 1 },
+        { .layer = 1, .default_layer = 1, .leds = 2 },
+    };
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < iterations; i++) {
+        // Read through the volatile index, so that the comparison isn't
+        // hoisted out of the loop
+        sink = i;
+        count += same_status(&statuses[0], &statuses[sink & 3]);
+    }
+    sink = count;
+}
+
+static void bench_format_layer_bitmap_string(uint32_t iterations) {
+    char buffer[32];
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < iterations; i++) {
+        format_layer_bitmap_string(1u << (i & 3), i, buffer);
+        sum += buffer[i % 19];
+    }
+    sink = sum;
+}
+
+// The benchmarked animations have continuously updating frames that don't do
+// anything, so that only the cost of the animation system is measured
+static bool bench_frame(keyframe_animation_t* animation, visualizer_state_t* state) {
+    (void)animation;
+    (void)state;
+    return true;
+}
+
+static const keyframe_t bench_keyframes[] = {
+    {MS2ST(100), bench_frame},
+    {MS2ST(100), bench_frame},
+};
+
+static const keyframe_animation_descriptor_t bench_animation_descriptor = {
+    KEYFRAMES(bench_keyframes),
+    .loop = true,
+};
+
+#define BENCH_MAX_ANIMATIONS MAX_SIMULTANEOUS_ANIMATIONS
+static keyframe_animation_t bench_animations[BENCH_MAX_ANIMATIONS];
+static visualizer_state_t bench_state;
+static uint32_t bench_num_animations;
+
+static void start_bench_animations(uint32_t count) {
+    stop_all_keyframe_animations();
+    for (uint32_t i = 0; i < count; i++) {
+        keyframe_animation_t* animation = &bench_animations[i];
+        memset(animation, 0, sizeof(*animation));
+        animation->descriptor = &bench_animation_descriptor;
+        animation->scheduler_index = -1;
+        start_keyframe_animation(animation);
+    }
+    bench_num_animations = count;
+}
+
+static void bench_update_keyframe_animation(uint32_t iterations) {
+    keyframe_animation_t* animation = &bench_animations[0];
+    for (uint32_t i = 0; i < iterations; i++) {
+        systime_t sleep_time = TIME_INFINITE;
+        update_keyframe_animation(animation, &bench_state, DEFAULT_KEYFRAME_INTERVAL, &sleep_time);
+        sink = sleep_time;
+    }
+}
+
+// Every animation is due on every call
+static void bench_update_animations(uint32_t iterations) {
+    for (uint32_t i = 0; i < iterations; i++) {
+        animation_time += DEFAULT_KEYFRAME_INTERVAL;
+        sink = update_animations(&bench_state);
+    }
+}
+
+static keyframe_t bench_fade_keyframes[] = {
+    {MS2ST(1000), NULL},
+};
+
+static const keyframe_animation_descriptor_t bench_fade_descriptor = {
+    KEYFRAMES(bench_fade_keyframes),
+    .loop = false,
+};
+
+static keyframe_animation_t bench_fade = { .descriptor = &bench_fade_descriptor };
+
+// A fade between two colors, at every position of the frame in turn
+static void bench_backlight_fade(uint32_t iterations) {
+    bench_state.prev_lcd_color = LCD_COLOR(0x10, 0x40, 0xFF);
+    bench_state.target_lcd_color = LCD_COLOR(0xF0, 0xFF, 0x30);
+    bench_fade.current_frame = 0;
+    int length = bench_fade_keyframes[0].length;
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < iterations; i++) {
+        bench_fade.time_left_in_frame = length - i % length;
+        bench_fade_keyframes[0].function(&bench_fade, &bench_state);
+        sum += bench_fade.time_to_next_update;
+    }
+    sink = sum;
+}
+
+// The matrix scan side of a key event, with the visualizer thread emptying
+// the queue whenever it's full, which adds the cost of taking the event out
+static void bench_key_event(uint32_t iterations) {
+    for (uint32_t i = 0; i < iterations; i++) {
+        if ((uint8_t)(key_event_head - key_event_tail) == VISUALIZER_KEY_EVENT_QUEUE_SIZE) {
+            dispatch_key_events(&bench_state);
+        }
+        visualizer_key_event(i & 0x7, i >> 3 & 0xF, i & 1);
+    }
+}
+
+static uint32_t thread_layer = 1;
+
+// The keyboard side and the visualizer thread, with a layer change on every
+// scan. Includes the cost of the simulated context switches.
+static void bench_thread_loop(uint32_t iterations) {
+    for (uint32_t i = 0; i < iterations; i++) {
+        thread_layer ^= 0x2;
+        visualizer_update(1, thread_layer, 0);
+        sim_advance(1);
+    }
+}
+
+int main(void) {
+    run_benchmark("hsi_to_rgb", 0, bench_hsi_to_rgb);
+    run_benchmark("lcd_backlight_color", 0, bench_lcd_backlight_color);
+    run_benchmark("same_status", 0, bench_same_status);
+    run_benchmark("format_layer_bitmap_string", 0, bench_format_layer_bitmap_string);
+
+    const frame_func fades[] = {
+        keyframe_animate_backlight_color,
+        keyframe_animate_backlight_color_ease_in,
+        keyframe_animate_backlight_color_ease_out,
+        keyframe_animate_backlight_color_ease_in_out,
+        keyframe_animate_backlight_color_smoothstep,
+    };
+    for (unsigned i = 0; i < sizeof(fades) / sizeof(fades[0]); i++) {
+        bench_fade_keyframes[0].function = fades[i];
+        run_benchmark("backlight_fade", i, bench_backlight_fade);
+    }
+
+    run_benchmark("key_event", 0, bench_key_event);
+
+    start_bench_animations(1);
+    heap_remove(&bench_animations[0]);
+    run_benchmark("update_keyframe_animation", 1, bench_update_keyframe_animation);
+    const uint32_t counts[] = {1, 8, MAX_SIMULTANEOUS_ANIMATIONS};
+    for (unsigned i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+        start_bench_animations(counts[i]);
+        run_benchmark("update_animations", bench_num_animations, bench_update_animations);
+    }
+    stop_all_keyframe_animations();
+
+    // The thread is only started at the end, the benchmarks above call the
+    // same functions directly
+    visualizer_init();
+    // Let the startup animation finish
+    sim_advance(MS2ST(10000));
+    run_benchmark("thread_loop", 0, bench_thread_loop);
+    return 0;
+}
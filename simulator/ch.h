@@ -0,0 +1,127 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Fred Sundvik
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// Host stand-in for the parts of the ChibiOS kernel API used by the visualizer.
+// Threads are run cooperatively on top of ucontext, and the system time is a
+// virtual clock that only moves when the simulation driver advances it, see
+// simulator.h. This makes every simulation run fully deterministic.
+
+#ifndef SIMULATOR_CH_H
+#define SIMULATOR_CH_H
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define CH_CFG_ST_FREQUENCY 1000
+
+typedef uint32_t systime_t;
+typedef uint32_t tprio_t;
+typedef uint32_t eventmask_t;
+typedef uint32_t eventflags_t;
+typedef uint64_t stkalign_t;
+typedef void (*tfunc_t)(void *p);
+
+#define TIME_IMMEDIATE ((systime_t)0)
+#define TIME_INFINITE ((systime_t)-1)
+
+#define S2ST(sec) ((systime_t)((uint32_t)(sec) * (uint32_t)CH_CFG_ST_FREQUENCY))
+#define MS2ST(msec) ((systime_t)((((uint32_t)(msec)) * \
+    ((uint32_t)CH_CFG_ST_FREQUENCY) + 999UL) / 1000UL))
+#define ST2MS(n) (((n) * 1000UL + CH_CFG_ST_FREQUENCY - 1UL) / \
+    CH_CFG_ST_FREQUENCY)
+
+#define IDLEPRIO 1
+#define LOWPRIO 2
+#define NORMALPRIO 128
+#define HIGHPRIO 255
+
+#define THD_STATE_READY 0
+#define THD_STATE_CURRENT 1
+#define THD_STATE_WTOREVT 2
+#define THD_STATE_FINAL 3
+#define THD_STATE_SLEEPING 4
+
+typedef struct thread {
+    tprio_t prio;
+    uint8_t state;
+    eventmask_t epending;
+    eventmask_t ewmask;
+    // Private simulator bookkeeping
+    void* sim;
+} thread_t;
+
+// The host needs a lot more stack than the target for the same code, so the
+// simulated port adds a generous fixed amount on top of what was requested
+#define SIM_PORT_STACK_OVERHEAD 16384
+#define PORT_WA_SIZE(n) ((n) + SIM_PORT_STACK_OVERHEAD)
+#define THD_WORKING_AREA_SIZE(n) \
+    ((sizeof(thread_t) + PORT_WA_SIZE(n) + sizeof(stkalign_t) - 1) & \
+     ~(sizeof(stkalign_t) - 1))
+#define THD_WORKING_AREA(s, n) \
+    stkalign_t s[THD_WORKING_AREA_SIZE(n) / sizeof(stkalign_t)]
+#define THD_FUNCTION(tname, arg) void tname(void *arg)
+
+thread_t* chThdCreateStatic(void* wsp, size_t size, tprio_t prio, tfunc_t pf, void* arg);
+thread_t* chThdGetSelfX(void);
+void chThdSleep(systime_t time);
+
+// The threads never preempt each other, and the simulated interrupts are
+// threads too, so the critical sections don't need to do anything
+#define chSysLock()
+#define chSysUnlock()
+#define chSysLockFromISR()
+#define chSysUnlockFromISR()
+
+systime_t chVTGetSystemTimeX(void);
+
+// The realtime counter runs on the host clock in nanoseconds, unlike the
+// system time, so it measures how long the code really takes on the host
+typedef uint32_t rtcnt_t;
+#define PORT_SUPPORTS_RT 1
+rtcnt_t chSysGetRealtimeCounterX(void);
+#define chVTGetSystemTime() chVTGetSystemTimeX()
+
+#define EVENT_MASK(eid) ((eventmask_t)1 << (eventmask_t)(eid))
+#define ALL_EVENTS ((eventmask_t)-1)
+
+typedef struct event_listener {
+    struct event_listener* next;
+    thread_t* listener;
+    eventmask_t events;
+} event_listener_t;
+
+typedef struct event_source {
+    event_listener_t* next;
+} event_source_t;
+
+void chEvtObjectInit(event_source_t* esp);
+void chEvtRegisterMask(event_source_t* esp, event_listener_t* elp, eventmask_t events);
+#define chEvtRegister(esp, elp, event) chEvtRegisterMask(esp, elp, EVENT_MASK(event))
+void chEvtUnregister(event_source_t* esp, event_listener_t* elp);
+void chEvtBroadcast(event_source_t* esp);
+void chEvtSignal(thread_t* tp, eventmask_t events);
+#define chEvtSignalI(tp, events) chEvtSignal(tp, events)
+eventmask_t chEvtWaitOneTimeout(eventmask_t events, systime_t time);
+
+#endif /* SIMULATOR_CH_H */
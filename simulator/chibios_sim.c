@@ -0,0 +1,242 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Fred Sundvik
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "ch.h"
+#include "simulator.h"
+#include <ucontext.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+// The visualizer, and the halves of the serial link simulation
+#define SIM_MAX_THREADS 8
+
+typedef struct {
+    thread_t* thread;
+    ucontext_t context;
+    tfunc_t func;
+    void* arg;
+    bool has_timeout;
+    uint64_t wakeup_time;
+} sim_thread_t;
+
+static sim_thread_t threads[SIM_MAX_THREADS];
+static int num_threads = 0;
+static sim_thread_t* current = NULL;
+static ucontext_t scheduler_context;
+// The clock is kept in 64 bits internally so that the timeouts are ordered
+// correctly even when systime_t wraps around
+static uint64_t current_time = 0;
+static sim_kernel_stats_t kernel_stats;
+
+static void thread_entry(void) {
+    current->func(current->arg);
+    current->thread->state = THD_STATE_FINAL;
+    // Returning resumes the scheduler through uc_link
+}
+
+thread_t* chThdCreateStatic(void* wsp, size_t size, tprio_t prio, tfunc_t pf, void* arg) {
+    if (num_threads == SIM_MAX_THREADS || size <= sizeof(thread_t)) {
+        abort();
+    }
+    // Like ChibiOS the thread structure is stored at the start of the working
+    // area, and the rest is used as the stack
+    thread_t* tp = (thread_t*)wsp;
+    memset(tp, 0, sizeof(thread_t));
+    tp->prio = prio;
+    tp->state = THD_STATE_READY;
+
+    sim_thread_t* st = &threads[num_threads++];
+    memset(st, 0, sizeof(sim_thread_t));
+    st->thread = tp;
+    st->func = pf;
+    st->arg = arg;
+    tp->sim = st;
+
+    getcontext(&st->context);
+    st->context.uc_stack.ss_sp = (uint8_t*)wsp + sizeof(thread_t);
+    st->context.uc_stack.ss_size = size - sizeof(thread_t);
+    st->context.uc_link = &scheduler_context;
+    makecontext(&st->context, thread_entry, 0);
+    return tp;
+}
+
+thread_t* chThdGetSelfX(void) {
+    return current ? current->thread : NULL;
+}
+
+systime_t chVTGetSystemTimeX(void) {
+    return (systime_t)current_time;
+}
+
+rtcnt_t chSysGetRealtimeCounterX(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (rtcnt_t)((uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec);
+}
+
+static sim_thread_t* highest_ready_thread(void) {
+    sim_thread_t* ret = NULL;
+    for (int i = 0; i < num_threads; i++) {
+        sim_thread_t* st = &threads[i];
+        if (st->thread->state == THD_STATE_READY &&
+                (ret == NULL || st->thread->prio > ret->thread->prio)) {
+            ret = st;
+        }
+    }
+    return ret;
+}
+
+static void ready_thread(sim_thread_t* st) {
+    st->has_timeout = false;
+    st->thread->state = THD_STATE_READY;
+}
+
+void sim_run_pending(void) {
+    sim_thread_t* st;
+    while ((st = highest_ready_thread()) != NULL) {
+        current = st;
+        st->thread->state = THD_STATE_CURRENT;
+        kernel_stats.thread_switches++;
+        swapcontext(&scheduler_context, &st->context);
+        current = NULL;
+    }
+}
+
+void sim_advance(systime_t ticks) {
+    uint64_t target = current_time + ticks;
+    while (true) {
+        sim_run_pending();
+        sim_thread_t* next = NULL;
+        for (int i = 0; i < num_threads; i++) {
+            sim_thread_t* st = &threads[i];
+            if (st->has_timeout && st->wakeup_time <= target &&
+                    (next == NULL || st->wakeup_time < next->wakeup_time)) {
+                next = st;
+            }
+        }
+        if (next == NULL) {
+            break;
+        }
+        current_time = next->wakeup_time;
+        ready_thread(next);
+    }
+    current_time = target;
+}
+
+// The paint loop keeps its own variables below the marker, at most in the
+// 128 byte red zone of the x86-64 ABI, so that much is left alone
+#define SIM_STACK_PAINT_MARGIN 128
+
+void sim_stack_paint(uint8_t value) {
+    volatile uint8_t marker = 0;
+    uintptr_t stack = (uintptr_t)current->context.uc_stack.ss_sp;
+    uintptr_t end = (uintptr_t)&marker - SIM_STACK_PAINT_MARGIN;
+    for (uintptr_t p = stack; p < end; p++) {
+        *(volatile uint8_t*)p = value;
+    }
+}
+
+size_t sim_stack_used(uint8_t value) {
+    const uint8_t* stack = current->context.uc_stack.ss_sp;
+    size_t size = current->context.uc_stack.ss_size;
+    size_t unused = 0;
+    while (unused < size && stack[unused] == value) {
+        unused++;
+    }
+    return size - unused;
+}
+
+void sim_get_kernel_stats(sim_kernel_stats_t* stats) {
+    *stats = kernel_stats;
+}
+
+static void block_current(systime_t timeout) {
+    if (timeout != TIME_INFINITE) {
+        current->has_timeout = true;
+        current->wakeup_time = current_time + timeout;
+    }
+    swapcontext(&current->context, &scheduler_context);
+}
+
+void chThdSleep(systime_t time) {
+    current->thread->state = THD_STATE_SLEEPING;
+    block_current(time);
+}
+
+void chEvtObjectInit(event_source_t* esp) {
+    esp->next = NULL;
+}
+
+void chEvtRegisterMask(event_source_t* esp, event_listener_t* elp, eventmask_t events) {
+    elp->next = esp->next;
+    elp->listener = chThdGetSelfX();
+    elp->events = events;
+    esp->next = elp;
+}
+
+void chEvtUnregister(event_source_t* esp, event_listener_t* elp) {
+    event_listener_t** p = &esp->next;
+    while (*p) {
+        if (*p == elp) {
+            *p = elp->next;
+            return;
+        }
+        p = &(*p)->next;
+    }
+}
+
+void chEvtSignal(thread_t* tp, eventmask_t events) {
+    tp->epending |= events;
+    if (tp->state == THD_STATE_WTOREVT && (tp->epending & tp->ewmask)) {
+        ready_thread(tp->sim);
+    }
+}
+
+void chEvtBroadcast(event_source_t* esp) {
+    for (event_listener_t* elp = esp->next; elp; elp = elp->next) {
+        chEvtSignal(elp->listener, elp->events);
+    }
+}
+
+eventmask_t chEvtWaitOneTimeout(eventmask_t events, systime_t time) {
+    thread_t* tp = current->thread;
+    eventmask_t m = tp->epending & events;
+    if (m == 0) {
+        if (time == TIME_IMMEDIATE) {
+            return 0;
+        }
+        tp->ewmask = events;
+        tp->state = THD_STATE_WTOREVT;
+        block_current(time);
+        m = tp->epending & events;
+        if (m == 0) {
+            return 0;
+        }
+    }
+    // Only the lowest pending event is returned
+    m ^= m & (m - 1);
+    tp->epending &= ~m;
+    return m;
+}
@@ -0,0 +1,40 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Fred Sundvik
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// The keyboard configuration used by the host simulation
+
+#ifndef SIMULATOR_CONFIG_H
+#define SIMULATOR_CONFIG_H
+
+#define VISUALIZER_THREAD_PRIORITY (NORMALPRIO - 2)
+
+#include "simulator.h"
+#define VISUALIZER_PROFILE_COUNTER_FREQUENCY 1000000000
+#define VISUALIZER_FRAME_BEGIN(function) sim_frame_begin((sim_function_t)(function))
+#define VISUALIZER_FRAME_END(function) sim_frame_end((sim_function_t)(function))
+// The trace uses the virtual clock, so that the latencies are deterministic
+#define VISUALIZER_TRACE_TIMESTAMP() chVTGetSystemTimeX()
+#define VISUALIZER_TRACE_COUNTER_FREQUENCY CH_CFG_ST_FREQUENCY
+
+#endif /* SIMULATOR_CONFIG_H */
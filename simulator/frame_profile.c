@@ -0,0 +1,134 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Fred Sundvik
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// Measures the peak stack usage of each frame function. The stack below the
+// caller is painted before each call, so a frame function is charged for the
+// deepest point it reaches, including the frames of the visualizer code that
+// called it.
+
+#include "simulator.h"
+#include "visualizer.h"
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SIM_MAX_PROFILED_FUNCTIONS 64
+
+typedef struct {
+    sim_function_t function;
+    uint32_t calls;
+    size_t stack_peak;
+} frame_profile_t;
+
+static frame_profile_t profiles[SIM_MAX_PROFILED_FUNCTIONS];
+static int num_profiles = 0;
+static bool enabled = false;
+static size_t stack_peak = 0;
+// The frame function that is running, it's tracked even when the profile is
+// not enabled
+static sim_function_t current_function = NULL;
+
+static frame_profile_t* find_profile(sim_function_t function) {
+    for (int i = 0; i < num_profiles; i++) {
+        if (profiles[i].function == function) {
+            return &profiles[i];
+        }
+    }
+    if (num_profiles == SIM_MAX_PROFILED_FUNCTIONS) {
+        return NULL;
+    }
+    frame_profile_t* profile = &profiles[num_profiles++];
+    memset(profile, 0, sizeof(*profile));
+    profile->function = function;
+    return profile;
+}
+
+void sim_frame_profile_enable(void) {
+    enabled = true;
+}
+
+void sim_frame_begin(sim_function_t function) {
+    current_function = function;
+    if (!enabled) {
+        return;
+    }
+    // Painting erases what happened before, so remember it first
+    size_t used = sim_stack_used(VISUALIZER_STACK_FILL_VALUE);
+    if (used > stack_peak) {
+        stack_peak = used;
+    }
+    sim_stack_paint(VISUALIZER_STACK_FILL_VALUE);
+}
+
+void sim_frame_end(sim_function_t function) {
+    current_function = NULL;
+    if (!enabled) {
+        return;
+    }
+    size_t used = sim_stack_used(VISUALIZER_STACK_FILL_VALUE);
+    if (used > stack_peak) {
+        stack_peak = used;
+    }
+    frame_profile_t* profile = find_profile(function);
+    if (profile) {
+        profile->calls++;
+        if (used > profile->stack_peak) {
+            profile->stack_peak = used;
+        }
+    }
+}
+
+sim_function_t sim_frame_current(void) {
+    return current_function;
+}
+
+size_t sim_frame_profile_stack_peak(void) {
+    return stack_peak;
+}
+
+void sim_function_name(sim_function_t function, char* name, size_t size) {
+    snprintf(name, size, "%p", (void*)(uintptr_t)function);
+    char command[128];
+    snprintf(command, sizeof(command), "addr2line -f -e /proc/%d/exe %p 2>/dev/null",
+            (int)getpid(), (void*)(uintptr_t)function);
+    FILE* pipe = popen(command, "r");
+    if (!pipe) {
+        return;
+    }
+    char line[128];
+    if (fgets(line, sizeof(line), pipe) && line[0] != '?') {
+        line[strcspn(line, "\n")] = 0;
+        snprintf(name, size, "%s", line);
+    }
+    pclose(pipe);
+}
+
+void sim_frame_profile_print(FILE* out) {
+    for (int i = 0; i < num_profiles; i++) {
+        char name[128];
+        sim_function_name(profiles[i].function, name, sizeof(name));
+        fprintf(out, "frame_stack_peak %s: %zu (%" PRIu32 " calls)\n",
+                name, profiles[i].stack_peak, profiles[i].calls);
+    }
+}
@@ -0,0 +1,567 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Fred Sundvik
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// In-memory implementation of the GDISP stand-in. The fonts are simple
+// monospaced replacements for the uGFX fonts, with the same names and
+// roughly the same metrics.
+//
+// The display memory is organized like in the monochrome LCD controllers,
+// each byte is a column of 8 pixels with the least significant bit at the
+// top, and a set bit is a black pixel. Every color other than White is drawn
+// as black.
+//
+// The pixel writes are counted by comparing the written area with a copy of
+// the pixels from before the write. The area is announced before writing,
+// and compared when the next write is announced, or the counts are read.
+// lcd_display writes the framebuffer directly, and announces the areas
+// through LCD_DISPLAY_FRAMEBUFFER_WRITE.
+
+#include "gfx.h"
+#include "lcd_display.h"
+#include "simulator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The asynchronous flushes are sent at the speed of a 400 kHz I2C bus, nine
+// clocks per byte
+#define TRANSFER_BYTES_PER_MS 44
+
+// The time the display takes to initialize, for the reset pulse and the
+// power up sequence of the controller
+#define INIT_TIME_MS 20
+
+struct mf_font_s {
+    const char* name;
+    coord_t height;
+    coord_t advance;
+    // Offset from the top of the line to the top of the glyphs
+    coord_t glyph_y;
+    bool bold;
+};
+
+#define NUM_PAGES (SIM_LCD_HEIGHT / 8)
+
+typedef uint8_t page_buffer_t[NUM_PAGES][SIM_LCD_WIDTH];
+
+struct GDisplay {
+    coord_t width;
+    coord_t height;
+    powermode_t power;
+    page_buffer_t pixels;
+    // The last flushed frame, which is what the real display would show
+    page_buffer_t flushed;
+    // The front buffer of the asynchronous flushes, and the transfer that is
+    // in progress
+    page_buffer_t front;
+    lcd_display_flush_t transfer;
+    uint32_t transfer_bytes;
+    bool transfer_busy;
+    thread_t* transfer_thread;
+    // The pixels before the pending write
+    page_buffer_t shadow;
+    bool write_pending;
+    coord_t write_x;
+    coord_t write_y;
+    coord_t write_cx;
+    coord_t write_cy;
+    sim_function_t write_function;
+    sim_lcd_stats_t stats;
+};
+
+static GDisplay display = {
+    .width = SIM_LCD_WIDTH,
+    .height = SIM_LCD_HEIGHT,
+};
+
+GDisplay* GDISP = &display;
+
+// The classic 5x7 font, 5 columns per glyph, least significant bit at the top
+static const uint8_t glyphs_5x7[][5] = {
+    {0x00, 0x00, 0x00, 0x00, 0x00}, {0x00, 0x00, 0x5F, 0x00, 0x00},
+    {0x00, 0x07, 0x00, 0x07, 0x00}, {0x14, 0x7F, 0x14, 0x7F, 0x14},
+    {0x24, 0x2A, 0x7F, 0x2A, 0x12}, {0x23, 0x13, 0x08, 0x64, 0x62},
+    {0x36, 0x49, 0x56, 0x20, 0x50}, {0x00, 0x05, 0x03, 0x00, 0x00},
+    {0x00, 0x1C, 0x22, 0x41, 0x00}, {0x00, 0x41, 0x22, 0x1C, 0x00},
+    {0x14, 0x08, 0x3E, 0x08, 0x14}, {0x08, 0x08, 0x3E, 0x08, 0x08},
+    {0x00, 0x50, 0x30, 0x00, 0x00}, {0x08, 0x08, 0x08, 0x08, 0x08},
+    {0x00, 0x60, 0x60, 0x00, 0x00}, {0x20, 0x10, 0x08, 0x04, 0x02},
+    {0x3E, 0x51, 0x49, 0x45, 0x3E}, {0x00, 0x42, 0x7F, 0x40, 0x00},
+    {0x42, 0x61, 0x51, 0x49, 0x46}, {0x21, 0x41, 0x45, 0x4B, 0x31},
+    {0x18, 0x14, 0x12, 0x7F, 0x10}, {0x27, 0x45, 0x45, 0x45, 0x39},
+    {0x3C, 0x4A, 0x49, 0x49, 0x30}, {0x01, 0x71, 0x09, 0x05, 0x03},
+    {0x36, 0x49, 0x49, 0x49, 0x36}, {0x06, 0x49, 0x49, 0x29, 0x1E},
+    {0x00, 0x36, 0x36, 0x00, 0x00}, {0x00, 0x56, 0x36, 0x00, 0x00},
+    {0x08, 0x14, 0x22, 0x41, 0x00}, {0x14, 0x14, 0x14, 0x14, 0x14},
+    {0x00, 0x41, 0x22, 0x14, 0x08}, {0x02, 0x01, 0x51, 0x09, 0x06},
+    {0x32, 0x49, 0x79, 0x41, 0x3E}, {0x7E, 0x11, 0x11, 0x11, 0x7E},
+    {0x7F, 0x49, 0x49, 0x49, 0x36}, {0x3E, 0x41, 0x41, 0x41, 0x22},
+    {0x7F, 0x41, 0x41, 0x22, 0x1C}, {0x7F, 0x49, 0x49, 0x49, 0x41},
+    {0x7F, 0x09, 0x09, 0x09, 0x01}, {0x3E, 0x41, 0x49, 0x49, 0x7A},
+    {0x7F, 0x08, 0x08, 0x08, 0x7F}, {0x00, 0x41, 0x7F, 0x41, 0x00},
+    {0x20, 0x40, 0x41, 0x3F, 0x01}, {0x7F, 0x08, 0x14, 0x22, 0x41},
+    {0x7F, 0x40, 0x40, 0x40, 0x40}, {0x7F, 0x02, 0x0C, 0x02, 0x7F},
+    {0x7F, 0x04, 0x08, 0x10, 0x7F}, {0x3E, 0x41, 0x41, 0x41, 0x3E},
+    {0x7F, 0x09, 0x09, 0x09, 0x06}, {0x3E, 0x41, 0x51, 0x21, 0x5E},
+    {0x7F, 0x09, 0x19, 0x29, 0x46}, {0x46, 0x49, 0x49, 0x49, 0x31},
+    {0x01, 0x01, 0x7F, 0x01, 0x01}, {0x3F, 0x40, 0x40, 0x40, 0x3F},
+    {0x1F, 0x20, 0x40, 0x20, 0x1F}, {0x3F, 0x40, 0x38, 0x40, 0x3F},
+    {0x63, 0x14, 0x08, 0x14, 0x63}, {0x07, 0x08, 0x70, 0x08, 0x07},
+    {0x61, 0x51, 0x49, 0x45, 0x43}, {0x00, 0x7F, 0x41, 0x41, 0x00},
+    {0x02, 0x04, 0x08, 0x10, 0x20}, {0x00, 0x41, 0x41, 0x7F, 0x00},
+    {0x04, 0x02, 0x01, 0x02, 0x04}, {0x40, 0x40, 0x40, 0x40, 0x40},
+    {0x00, 0x01, 0x02, 0x04, 0x00}, {0x20, 0x54, 0x54, 0x54, 0x78},
+    {0x7F, 0x48, 0x44, 0x44, 0x38}, {0x38, 0x44, 0x44, 0x44, 0x20},
+    {0x38, 0x44, 0x44, 0x48, 0x7F}, {0x38, 0x54, 0x54, 0x54, 0x18},
+    {0x08, 0x7E, 0x09, 0x01, 0x02}, {0x0C, 0x52, 0x52, 0x52, 0x3E},
+    {0x7F, 0x08, 0x04, 0x04, 0x78}, {0x00, 0x44, 0x7D, 0x40, 0x00},
+    {0x20, 0x40, 0x44, 0x3D, 0x00}, {0x7F, 0x10, 0x28, 0x44, 0x00},
+    {0x00, 0x41, 0x7F, 0x40, 0x00}, {0x7C, 0x04, 0x18, 0x04, 0x78},
+    {0x7C, 0x08, 0x04, 0x04, 0x78}, {0x38, 0x44, 0x44, 0x44, 0x38},
+    {0x7C, 0x14, 0x14, 0x14, 0x08}, {0x08, 0x14, 0x14, 0x18, 0x7C},
+    {0x7C, 0x08, 0x04, 0x04, 0x08}, {0x48, 0x54, 0x54, 0x54, 0x20},
+    {0x04, 0x3F, 0x44, 0x40, 0x20}, {0x3C, 0x40, 0x40, 0x20, 0x7C},
+    {0x1C, 0x20, 0x40, 0x20, 0x1C}, {0x3C, 0x40, 0x30, 0x40, 0x3C},
+    {0x44, 0x28, 0x10, 0x28, 0x44}, {0x0C, 0x50, 0x50, 0x50, 0x3C},
+    {0x44, 0x64, 0x54, 0x4C, 0x44}, {0x00, 0x08, 0x36, 0x41, 0x00},
+    {0x00, 0x00, 0x7F, 0x00, 0x00}, {0x00, 0x41, 0x36, 0x08, 0x00},
+    {0x10, 0x08, 0x08, 0x10, 0x08},
+};
+
+#define FIRST_GLYPH ' '
+#define LAST_GLYPH '~'
+
+static const struct mf_font_s fonts[] = {
+    {.name = "fixed_5x8", .height = 8, .advance = 6, .glyph_y = 0, .bold = false},
+    {.name = "DejaVuSansBold12", .height = 12, .advance = 7, .glyph_y = 2, .bold = true},
+};
+
+static uint32_t copy_area(page_buffer_t dst, page_buffer_t src,
+        coord_t x, coord_t y, coord_t cx, coord_t cy) {
+    coord_t y2 = y + cy > SIM_LCD_HEIGHT ? SIM_LCD_HEIGHT : y + cy;
+    uint32_t bytes = 0;
+    for (coord_t page = y / 8; page * 8 < y2; page++) {
+        uint8_t mask = 0xFF;
+        if (y > page * 8) {
+            mask &= 0xFF << (y - page * 8);
+        }
+        if (y2 < page * 8 + 8) {
+            mask &= 0xFF >> (page * 8 + 8 - y2);
+        }
+        for (coord_t i = x; i < x + cx; i++) {
+            dst[page][i] = (dst[page][i] & ~mask) | (src[page][i] & mask);
+        }
+        bytes += cx;
+    }
+    return bytes;
+}
+
+static sim_lcd_work_t work[SIM_MAX_LCD_WORK];
+static int num_work = 0;
+static const char* dump_directory = NULL;
+static uint32_t dumped_frames = 0;
+
+static sim_lcd_work_t* find_work(sim_function_t function) {
+    for (int i = 0; i < num_work; i++) {
+        if (work[i].function == function) {
+            return &work[i];
+        }
+    }
+    if (num_work == SIM_MAX_LCD_WORK) {
+        return NULL;
+    }
+    sim_lcd_work_t* w = &work[num_work++];
+    memset(w, 0, sizeof(*w));
+    w->function = function;
+    return w;
+}
+
+static void count_pending_write(GDisplay* g) {
+    if (!g->write_pending) {
+        return;
+    }
+    g->write_pending = false;
+    uint32_t written = 0;
+    uint32_t unchanged = 0;
+    for (coord_t y = g->write_y; y < g->write_y + g->write_cy; y++) {
+        uint8_t bit = 1 << (y % 8);
+        for (coord_t x = g->write_x; x < g->write_x + g->write_cx; x++) {
+            written++;
+            if (((g->pixels[y / 8][x] ^ g->shadow[y / 8][x]) & bit) == 0) {
+                unchanged++;
+            }
+        }
+    }
+    copy_area(g->shadow, g->pixels, g->write_x, g->write_y, g->write_cx, g->write_cy);
+    g->stats.pixels_written += written;
+    g->stats.pixels_unchanged += unchanged;
+    sim_lcd_work_t* w = find_work(g->write_function);
+    if (w) {
+        w->pixels_written += written;
+        w->pixels_unchanged += unchanged;
+    }
+}
+
+static void begin_write(GDisplay* g, coord_t x, coord_t y, coord_t cx, coord_t cy) {
+    count_pending_write(g);
+    coord_t x2 = x + cx > g->width ? g->width : x + cx;
+    coord_t y2 = y + cy > g->height ? g->height : y + cy;
+    x = x < 0 ? 0 : x;
+    y = y < 0 ? 0 : y;
+    if (x >= x2 || y >= y2) {
+        return;
+    }
+    g->write_pending = true;
+    g->write_x = x;
+    g->write_y = y;
+    g->write_cx = x2 - x;
+    g->write_cy = y2 - y;
+    g->write_function = sim_frame_current();
+}
+
+static void count_flush(uint32_t bytes) {
+    sim_lcd_work_t* w = find_work(sim_frame_current());
+    if (w) {
+        w->flushes++;
+        w->flushed_bytes += bytes;
+    }
+}
+
+// Writes what the display shows as a binary PBM image
+static void dump_frame(GDisplay* g) {
+    if (dump_directory == NULL) {
+        return;
+    }
+    char path[256];
+    snprintf(path, sizeof(path), "%s/frame_%05u.pbm", dump_directory, dumped_frames++);
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        perror(path);
+        return;
+    }
+    fprintf(file, "P4\n# %lu ms\n%d %d\n", (unsigned long)ST2MS(chVTGetSystemTimeX()),
+            (int)g->width, (int)g->height);
+    for (coord_t y = 0; y < g->height; y++) {
+        for (coord_t x = 0; x < g->width; x += 8) {
+            uint8_t byte = 0;
+            for (coord_t i = 0; i < 8 && x + i < g->width; i++) {
+                if (g->flushed[y / 8][x + i] & (1 << (y % 8))) {
+                    byte |= 0x80 >> i;
+                }
+            }
+            fputc(byte, file);
+        }
+    }
+    fclose(file);
+}
+
+#if LCD_ASYNC_FLUSH
+// Plays the role of the DMA controller, it waits for as long as sending the
+// areas would take, then shows them on the display and raises the completion
+// interrupt
+static THD_WORKING_AREA(transferThreadStack, 256);
+static THD_FUNCTION(transferThread, arg) {
+    GDisplay* g = arg;
+    while (true) {
+        chEvtWaitOneTimeout(EVENT_MASK(0), TIME_INFINITE);
+        chThdSleep(MS2ST((g->transfer_bytes + TRANSFER_BYTES_PER_MS - 1) / TRANSFER_BYTES_PER_MS));
+        for (int i = 0; i < g->transfer.num_areas; i++) {
+            lcd_display_area_t* area = &g->transfer.areas[i];
+            copy_area(g->flushed, g->front, area->x, area->y, area->cx, area->cy);
+        }
+        g->stats.flushed_bytes += g->transfer_bytes;
+        g->stats.async_flushes++;
+        dump_frame(g);
+        g->transfer_busy = false;
+        chSysLockFromISR();
+        lcd_display_flush_completeI();
+        chSysUnlockFromISR();
+    }
+}
+#endif
+
+void gfxHalt(const char* msg) {
+    fprintf(stderr, "gfxHalt: %s\n", msg);
+    abort();
+}
+
+void gfxInit(void) {
+    chThdSleep(MS2ST(INIT_TIME_MS));
+    display.power = powerOn;
+    gdispGClear(&display, White);
+    memcpy(display.flushed, display.pixels, sizeof(display.pixels));
+    memcpy(display.front, display.pixels, sizeof(display.pixels));
+#if LCD_ASYNC_FLUSH
+    display.transfer_thread = chThdCreateStatic(transferThreadStack, sizeof(transferThreadStack),
+            HIGHPRIO, transferThread, &display);
+#endif
+}
+
+coord_t gdispGGetWidth(GDisplay* g) {
+    return g->width;
+}
+
+coord_t gdispGGetHeight(GDisplay* g) {
+    return g->height;
+}
+
+void gdispGFlush(GDisplay* g) {
+    uint32_t bytes = copy_area(g->flushed, g->pixels, 0, 0, g->width, g->height);
+    g->stats.flushed_bytes += bytes;
+    g->stats.flushes++;
+    count_flush(bytes);
+    dump_frame(g);
+}
+
+void gdispGClear(GDisplay* g, color_t color) {
+    begin_write(g, 0, 0, g->width, g->height);
+    memset(g->pixels, color == White ? 0x00 : 0xFF, sizeof(g->pixels));
+    g->stats.clears++;
+}
+
+void gdispGDrawPixel(GDisplay* g, coord_t x, coord_t y, color_t color) {
+    if (x >= 0 && x < g->width && y >= 0 && y < g->height) {
+        begin_write(g, x, y, 1, 1);
+        if (color == White) {
+            g->pixels[y / 8][x] &= ~(1 << (y % 8));
+        }
+        else {
+            g->pixels[y / 8][x] |= 1 << (y % 8);
+        }
+    }
+}
+
+void gdispGFillArea(GDisplay* g, coord_t x, coord_t y, coord_t cx, coord_t cy, color_t color) {
+    for (coord_t j = y; j < y + cy; j++) {
+        for (coord_t i = x; i < x + cx; i++) {
+            gdispGDrawPixel(g, i, j, color);
+        }
+    }
+}
+
+color_t gdispGGetPixelColor(GDisplay* g, coord_t x, coord_t y) {
+    if (x >= 0 && x < g->width && y >= 0 && y < g->height) {
+        return g->pixels[y / 8][x] & (1 << (y % 8)) ? Black : White;
+    }
+    return 0;
+}
+
+uint8_t mf_render_character(const struct mf_font_s* font, int16_t x, int16_t y,
+        mf_char character, mf_pixel_callback_t callback, void* state) {
+    if (character < FIRST_GLYPH || character > LAST_GLYPH) {
+        return 0;
+    }
+    const uint8_t* glyph = glyphs_5x7[character - FIRST_GLYPH];
+    for (int row = 0; row < 8; row++) {
+        // The columns of the row, the bold font repeats every column one
+        // pixel to the right
+        uint8_t columns = 0;
+        for (int col = 0; col < 5; col++) {
+            if (glyph[col] & (1 << row)) {
+                columns |= 1 << col;
+            }
+        }
+        if (font->bold) {
+            columns |= columns << 1;
+        }
+        int col = 0;
+        while (columns >> col) {
+            if (columns & (1 << col)) {
+                int start = col;
+                while (columns & (1 << col)) {
+                    col++;
+                }
+                callback(x + start, y + font->glyph_y + row, col - start, 255, state);
+            }
+            else {
+                col++;
+            }
+        }
+    }
+    return font->advance;
+}
+
+void mf_render_aligned(const struct mf_font_s* font, int16_t x, int16_t y, enum mf_align_t align,
+        mf_str text, uint16_t count, mf_character_callback_t callback, void* state) {
+    uint16_t len = strlen(text);
+    if (count == 0 || count > len) {
+        count = len;
+    }
+    if (align == MF_ALIGN_CENTER) {
+        x -= count * font->advance / 2;
+    }
+    else if (align == MF_ALIGN_RIGHT) {
+        x -= count * font->advance;
+    }
+    for (uint16_t i = 0; i < count; i++) {
+        x += callback(x, y, (uint8_t)text[i], state);
+    }
+}
+
+typedef struct {
+    GDisplay* g;
+    color_t color;
+} draw_char_state_t;
+
+static void draw_char_pixels(int16_t x, int16_t y, uint8_t count, uint8_t alpha, void* state) {
+    draw_char_state_t* s = state;
+    (void)alpha;
+    for (int16_t i = 0; i < count; i++) {
+        gdispGDrawPixel(s->g, x + i, y, s->color);
+    }
+}
+
+void gdispGDrawChar(GDisplay* g, coord_t x, coord_t y, uint16_t c, font_t font, color_t color) {
+    draw_char_state_t state = {.g = g, .color = color};
+    mf_render_character(font, x, y, c, draw_char_pixels, &state);
+}
+
+void gdispGDrawString(GDisplay* g, coord_t x, coord_t y, const char* str, font_t font, color_t color) {
+    if (str == NULL) {
+        return;
+    }
+    for (; *str; str++) {
+        gdispGDrawChar(g, x, y, (uint8_t)*str, font, color);
+        x += font->advance;
+    }
+}
+
+void gdispGBlitArea(GDisplay* g, coord_t x, coord_t y, coord_t cx, coord_t cy,
+        coord_t srcx, coord_t srcy, coord_t srccx, const pixel_t* buffer) {
+    for (coord_t j = 0; j < cy; j++) {
+        for (coord_t i = 0; i < cx; i++) {
+            gdispGDrawPixel(g, x + i, y + j, buffer[(srcy + j) * srccx + srcx + i]);
+        }
+    }
+}
+
+void* gdispGQuery(GDisplay* g, unsigned what) {
+    if (what == GDISP_QUERY_LCD_FRAMEBUFFER) {
+        return g->pixels;
+    }
+    return NULL;
+}
+
+void gdispGControl(GDisplay* g, unsigned what, void* value) {
+    if (what == GDISP_CONTROL_POWER) {
+        g->power = (powermode_t)(uintptr_t)value;
+    }
+    else if (what == GDISP_CONTROL_LCD_FLUSH_AREA) {
+        lcd_display_area_t* area = value;
+        uint32_t bytes = copy_area(g->flushed, g->pixels, area->x, area->y, area->cx, area->cy);
+        g->stats.flushed_bytes += bytes;
+        g->stats.partial_flushes++;
+        count_flush(bytes);
+        dump_frame(g);
+    }
+#if LCD_ASYNC_FLUSH
+    else if (what == GDISP_CONTROL_LCD_FLUSH_START) {
+        if (g->transfer_busy) {
+            // The front buffer is overwritten in the middle of a transfer
+            g->stats.torn_flushes++;
+        }
+        lcd_display_flush_t* flush = value;
+        g->transfer_bytes = 0;
+        for (int i = 0; i < flush->num_areas; i++) {
+            lcd_display_area_t* area = &flush->areas[i];
+            g->transfer_bytes += copy_area(g->front, g->pixels, area->x, area->y, area->cx, area->cy);
+        }
+        g->transfer = *flush;
+        g->transfer_busy = true;
+        count_flush(g->transfer_bytes);
+        chEvtSignalI(g->transfer_thread, EVENT_MASK(0));
+    }
+#endif
+}
+
+font_t gdispOpenFont(const char* name) {
+    for (unsigned i = 0; i < sizeof(fonts) / sizeof(fonts[0]); i++) {
+        if (strcmp(fonts[i].name, name) == 0) {
+            return &fonts[i];
+        }
+    }
+    // uGFX also falls back to the first font
+    return &fonts[0];
+}
+
+void gdispCloseFont(font_t font) {
+    (void)font;
+}
+
+coord_t gdispGetFontMetric(font_t font, fontmetric_t metric) {
+    switch (metric) {
+    case fontHeight:
+    case fontLineSpacing:
+        return font->height;
+    case fontMinWidth:
+    case fontMaxWidth:
+        return font->advance;
+    case fontBaselineY:
+        return font->glyph_y + 7;
+    default:
+        return 0;
+    }
+}
+
+coord_t gdispGetCharWidth(char c, font_t font) {
+    (void)c;
+    return font->advance;
+}
+
+coord_t gdispGetStringWidth(const char* str, font_t font) {
+    return str ? (coord_t)(strlen(str) * font->advance) : 0;
+}
+
+void sim_get_lcd_stats(sim_lcd_stats_t* stats) {
+    count_pending_write(&display);
+    *stats = display.stats;
+    stats->powered = display.power == powerOn;
+}
+
+bool sim_lcd_get_pixel(int x, int y) {
+    return display.flushed[y / 8][x] & (1 << (y % 8));
+}
+
+void sim_lcd_print(FILE* out) {
+    for (int y = 0; y < SIM_LCD_HEIGHT; y++) {
+        for (int x = 0; x < SIM_LCD_WIDTH; x++) {
+            fputc(sim_lcd_get_pixel(x, y) ? '#' : '.', out);
+        }
+        fputc('\n', out);
+    }
+}
+
+int sim_lcd_get_work(const sim_lcd_work_t** result) {
+    count_pending_write(&display);
+    *result = work;
+    return num_work;
+}
+
+void sim_lcd_dump_frames(const char* directory) {
+    dump_directory = directory;
+}
+
+void sim_lcd_framebuffer_write(int x, int y, int cx, int cy) {
+    begin_write(&display, x, y, cx, cy);
+}
@@ -0,0 +1,141 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Fred Sundvik
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// Host stand-in for the subset of the uGFX GDISP API used by the visualizer.
+// The display is a framebuffer in memory, see simulator.h for how to inspect
+// it. The names and signatures follow uGFX, so that visualizers written for
+// the real library compile unchanged.
+
+#ifndef SIMULATOR_GFX_H
+#define SIMULATOR_GFX_H
+#include <stdint.h>
+#include <stdbool.h>
+#include "ch.h"
+#include "gfxconf.h"
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+typedef int16_t coord_t;
+typedef uint32_t color_t;
+typedef color_t pixel_t;
+
+#define HTML2COLOR(h) ((color_t)(h))
+#define White HTML2COLOR(0xFFFFFF)
+#define Black HTML2COLOR(0x000000)
+
+typedef enum powermode {
+    powerOff,
+    powerSleep,
+    powerDeepSleep,
+    powerOn
+} powermode_t;
+
+typedef enum fontmetric {
+    fontHeight,
+    fontDescendersHeight,
+    fontLineSpacing,
+    fontCharPadding,
+    fontMinWidth,
+    fontMaxWidth,
+    fontBaselineX,
+    fontBaselineY
+} fontmetric_t;
+
+typedef const struct mf_font_s* font_t;
+
+typedef struct GDisplay GDisplay;
+extern GDisplay* GDISP;
+
+#define GDISP_CONTROL_POWER 0
+#define GDISP_CONTROL_ORIENTATION 1
+#define GDISP_CONTROL_BACKLIGHT 2
+#define GDISP_CONTROL_CONTRAST 3
+#define GDISP_CONTROL_LLD 1000
+#define GDISP_QUERY_LLD 1000
+
+void gfxInit(void);
+// Prints the message and aborts
+void gfxHalt(const char* msg);
+
+coord_t gdispGGetWidth(GDisplay* g);
+coord_t gdispGGetHeight(GDisplay* g);
+void gdispGFlush(GDisplay* g);
+void gdispGClear(GDisplay* g, color_t color);
+void gdispGDrawPixel(GDisplay* g, coord_t x, coord_t y, color_t color);
+void gdispGFillArea(GDisplay* g, coord_t x, coord_t y, coord_t cx, coord_t cy, color_t color);
+color_t gdispGGetPixelColor(GDisplay* g, coord_t x, coord_t y);
+void gdispGDrawChar(GDisplay* g, coord_t x, coord_t y, uint16_t c, font_t font, color_t color);
+void gdispGDrawString(GDisplay* g, coord_t x, coord_t y, const char* str, font_t font, color_t color);
+void gdispGBlitArea(GDisplay* g, coord_t x, coord_t y, coord_t cx, coord_t cy,
+        coord_t srcx, coord_t srcy, coord_t srccx, const pixel_t* buffer);
+void gdispGControl(GDisplay* g, unsigned what, void* value);
+void* gdispGQuery(GDisplay* g, unsigned what);
+
+font_t gdispOpenFont(const char* name);
+void gdispCloseFont(font_t font);
+coord_t gdispGetFontMetric(font_t font, fontmetric_t metric);
+coord_t gdispGetCharWidth(char c, font_t font);
+coord_t gdispGetStringWidth(const char* str, font_t font);
+
+#define gdispGetWidth() gdispGGetWidth(GDISP)
+#define gdispGetHeight() gdispGGetHeight(GDISP)
+#define gdispFlush() gdispGFlush(GDISP)
+#define gdispClear(c) gdispGClear(GDISP, c)
+#define gdispDrawPixel(x, y, c) gdispGDrawPixel(GDISP, x, y, c)
+#define gdispFillArea(x, y, cx, cy, c) gdispGFillArea(GDISP, x, y, cx, cy, c)
+#define gdispGetPixelColor(x, y) gdispGGetPixelColor(GDISP, x, y)
+#define gdispDrawChar(x, y, s, f, c) gdispGDrawChar(GDISP, x, y, s, f, c)
+#define gdispDrawString(x, y, s, f, c) gdispGDrawString(GDISP, x, y, s, f, c)
+#define gdispBlitAreaEx(x, y, cx, cy, sx, sy, rx, b) \
+    gdispGBlitArea(GDISP, x, y, cx, cy, sx, sy, rx, b)
+#define gdispBlitArea(x, y, cx, cy, b) gdispBlitAreaEx(x, y, cx, cy, 0, 0, cx, b)
+#define gdispControl(w, v) gdispGControl(GDISP, w, v)
+#define gdispQuery(w) gdispGQuery(GDISP, w)
+#define gdispGSetPowerMode(g, powerMode) \
+    gdispGControl(g, GDISP_CONTROL_POWER, (void*)(uintptr_t)(powerMode))
+#define gdispSetPowerMode(powerMode) gdispGSetPowerMode(GDISP, powerMode)
+
+// The mcufont rendering functions that uGFX uses for the text, the glyphs are
+// reported as horizontal runs of pixels
+typedef const char* mf_str;
+typedef uint16_t mf_char;
+enum mf_align_t {
+    MF_ALIGN_LEFT,
+    MF_ALIGN_CENTER,
+    MF_ALIGN_RIGHT
+};
+typedef void (*mf_pixel_callback_t)(int16_t x, int16_t y, uint8_t count, uint8_t alpha, void* state);
+typedef uint8_t (*mf_character_callback_t)(int16_t x, int16_t y, mf_char character, void* state);
+
+uint8_t mf_render_character(const struct mf_font_s* font, int16_t x, int16_t y,
+        mf_char character, mf_pixel_callback_t callback, void* state);
+void mf_render_aligned(const struct mf_font_s* font, int16_t x, int16_t y, enum mf_align_t align,
+        mf_str text, uint16_t count, mf_character_callback_t callback, void* state);
+
+#endif /* SIMULATOR_GFX_H */
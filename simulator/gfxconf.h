@@ -0,0 +1,44 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Fred Sundvik
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// The uGFX and visualizer display configuration of the host simulation
+
+#ifndef SIMULATOR_GFXCONF_H
+#define SIMULATOR_GFXCONF_H
+
+// The simulated display driver supports GDISP_CONTROL_LCD_FLUSH_AREA
+#define LCD_PARTIAL_FLUSH TRUE
+// And sends the frames in the background, see gdisp_sim.c
+#define LCD_ASYNC_FLUSH TRUE
+// And keeps the framebuffer packed like a monochrome LCD controller
+#define LCD_PACKED_FRAMEBUFFER TRUE
+// Room for four full frames
+#define LCD_FRAME_CACHE_SIZE (4 * 128 * 32 / 8)
+// Room for the pre-rendered glyphs of fixed_5x8
+#define LCD_GLYPH_CACHE_SIZE 1024
+// Counts the pixels that are written directly into the framebuffer
+#include "simulator.h"
+#define LCD_DISPLAY_FRAMEBUFFER_WRITE(x, y, cx, cy) sim_lcd_framebuffer_write(x, y, cx, cy)
+
+#endif /* SIMULATOR_GFXCONF_H */
@@ -0,0 +1,102 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Fred Sundvik
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// Backlight HAL for the host simulation, the PWM values are recorded in a
+// log instead of being written to the timer registers
+
+#include "lcd_backlight.h"
+#include "simulator.h"
+
+static sim_backlight_write_t write_log[SIM_BACKLIGHT_LOG_SIZE];
+static uint32_t write_count = 0;
+
+static void write_color(uint16_t r, uint16_t g, uint16_t b) {
+    sim_backlight_write_t* w = &write_log[write_count % SIM_BACKLIGHT_LOG_SIZE];
+    w->time = chVTGetSystemTimeX();
+    w->r = r;
+    w->g = g;
+    w->b = b;
+    write_count++;
+}
+
+#ifdef LCD_BACKLIGHT_WAVEFORM
+// The waveform is played back by a high priority thread, which stands in for
+// the timer triggered DMA on the real hardware. It's signalled whenever the
+// waveform is replaced or stopped.
+static const lcd_backlight_rgb_t* waveform;
+static uint16_t waveform_count = 0;
+static systime_t waveform_period;
+static thread_t* player_thread = NULL;
+
+static THD_WORKING_AREA(playerThreadStack, 256);
+static THD_FUNCTION(playerThread, arg) {
+    (void)arg;
+    uint16_t pos = 0;
+    while (true) {
+        systime_t timeout = pos < waveform_count ? waveform_period : TIME_INFINITE;
+        if (chEvtWaitOneTimeout(EVENT_MASK(0), timeout)) {
+            pos = 0;
+        }
+        else {
+            const lcd_backlight_rgb_t* value = &waveform[pos++];
+            write_color(value->r, value->g, value->b);
+        }
+    }
+}
+
+void lcd_backlight_hal_play(const lcd_backlight_rgb_t* values, uint16_t count, uint16_t period_ms) {
+    waveform = values;
+    waveform_count = count;
+    waveform_period = MS2ST(period_ms);
+    chEvtSignal(player_thread, EVENT_MASK(0));
+}
+#endif
+
+void lcd_backlight_hal_init(void) {
+#ifdef LCD_BACKLIGHT_WAVEFORM
+    player_thread = chThdCreateStatic(playerThreadStack, sizeof(playerThreadStack),
+            HIGHPRIO, playerThread, NULL);
+#endif
+}
+
+void lcd_backlight_hal_color(uint16_t r, uint16_t g, uint16_t b) {
+#ifdef LCD_BACKLIGHT_WAVEFORM
+    if (waveform_count) {
+        waveform_count = 0;
+        chEvtSignal(player_thread, EVENT_MASK(0));
+    }
+#endif
+    write_color(r, g, b);
+}
+
+uint32_t sim_backlight_get_write_count(void) {
+    return write_count;
+}
+
+const sim_backlight_write_t* sim_backlight_get_write(uint32_t age) {
+    if (age >= write_count || age >= SIM_BACKLIGHT_LOG_SIZE) {
+        return NULL;
+    }
+    return &write_log[(write_count - 1 - age) % SIM_BACKLIGHT_LOG_SIZE];
+}
@@ -0,0 +1,107 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Fred Sundvik
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// One half of a split keyboard for the serial link simulation. It's linked
+// together with a build of visualizer.c that has USE_SERIAL_LINK, and then all
+// the symbols except sim_link_node are made local, and that is renamed, see
+// the Makefile. So each half is an independent instance of the visualizer,
+// with its own clock, and the same user code, which records the status that
+// it sees, and restarts an animation that records its position.
+
+#include "serial_link_sim.h"
+#include "serial_link/protocol/transport.h"
+#include "serial_link/system/serial_link.h"
+#include <string.h>
+
+static void node_init(void);
+
+sim_link_node_t sim_link_node = {
+    .init = node_init,
+    .update = visualizer_update,
+#ifdef VISUALIZER_CLOCK_SYNC
+    .get_clock_sync = visualizer_get_clock_sync,
+#endif
+};
+
+static bool keyframe_record_position(keyframe_animation_t* animation, visualizer_state_t* state) {
+    (void)state;
+    sim_link_node.position = SIM_LINK_ANIMATION_PERIOD - animation->time_left_in_frame;
+    return true;
+}
+
+static const keyframe_t position_keyframes[] = {
+    {SIM_LINK_ANIMATION_PERIOD, keyframe_record_position},
+};
+
+// Updated on every tick, so that the position is always current
+static const keyframe_animation_descriptor_t position_animation_descriptor = {
+    KEYFRAMES(position_keyframes),
+    .loop = true,
+    .frame_interval = 1,
+};
+
+static keyframe_animation_t position_animation = {
+    .descriptor = &position_animation_descriptor,
+};
+
+static void node_init(void) {
+    // Like on the keyboard, the status is unknown until the first update
+    memset(&sim_link_node.status, 0xFF, sizeof(sim_link_node.status));
+    sim_link_node.changes = 0;
+    sim_link_node.position = -1;
+    visualizer_init();
+}
+
+systime_t chVTGetSystemTimeX(void) {
+    return sim_link_node.clock();
+}
+
+bool is_serial_link_connected(void) {
+    return sim_link_node.slave;
+}
+
+void add_remote_objects(remote_object_t** remote_objects, uint32_t num_remote_objects) {
+    // The visualizer has only the status object
+    (void)num_remote_objects;
+    sim_link_node.object = remote_objects[0];
+}
+
+void initialize_user_visualizer(visualizer_state_t* state) {
+    enable_visualization(NULL, state);
+}
+
+void update_user_visualizer_state_changes(visualizer_state_t* state, const visualizer_status_change_t* change) {
+    (void)change;
+    sim_link_node.status = state->status;
+    sim_link_node.changes++;
+    start_keyframe_animation(&position_animation);
+}
+
+void user_visualizer_suspend(visualizer_state_t* state) {
+    sim_link_node.status = state->status;
+}
+
+void user_visualizer_resume(visualizer_state_t* state) {
+    enable_visualization(NULL, state);
+}
@@ -0,0 +1,516 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Fred Sundvik
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// Drives the visualizer through a scripted session of typing, layer changes
+// and suspend/resume, and prints a summary of what it did. With --serial-link
+// it instead measures the status traffic of a split keyboard, and with
+// --clock-sync how far apart the animations of the halves are. With
+// --stack-report it also runs the built-in keyframes that the session doesn't
+// use, and reports the peak stack usage of each frame function. --profile
+// prints the timing profile of the visualizer thread, --trace the latencies
+// of the status changes and --trace-events the trace that they are computed
+// from. --record=file writes the calls of the session to the visualizer into
+// a file, and --replay=file replays such a recording instead of the session,
+// as fast as possible, and prints the same summary for it. --overdraw prints
+// the pixels that each frame function wrote to the LCD, and how many of them
+// didn't change, and --dump-frames=directory writes every frame that was
+// flushed to the LCD as a PBM image. The frames flushed by the visualizer
+// thread are written on its stack, which then shows in stack_used. --typing
+// also types on the keyboard during the session, and prints how many of the
+// key events reached the visualizer.
+
+#include "simulator.h"
+#include "visualizer.h"
+#include "visualizer_record.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static uint32_t default_layer_state = 1;
+static uint32_t layer_state = 1;
+static uint32_t leds = 0;
+
+// With --typing a key is pressed every KEY_INTERVAL ms, and released
+// KEY_HOLD ms later
+#define KEY_INTERVAL 150
+#define KEY_HOLD 60
+#define KEY_ROWS 5
+#define KEY_COLS 14
+static bool typing = false;
+static uint32_t keys_typed = 0;
+static uint32_t key_events_sent = 0;
+
+static void send_key_event(uint8_t row, uint8_t col, bool pressed) {
+    visualizer_key_event(row, col, pressed);
+    key_events_sent++;
+}
+
+static void type_keys(void) {
+    systime_t time = chVTGetSystemTimeX();
+    uint8_t row = keys_typed / KEY_COLS % KEY_ROWS;
+    uint8_t col = keys_typed % KEY_COLS;
+    if (time % MS2ST(KEY_INTERVAL) == 0) {
+        send_key_event(row, col, true);
+    }
+    else if (time % MS2ST(KEY_INTERVAL) == MS2ST(KEY_HOLD)) {
+        send_key_event(row, col, false);
+        keys_typed++;
+    }
+}
+
+// Presses and releases a whole row of keys in the same scan, like a palm on
+// the keyboard, which is more than the key event queue holds
+static void mash_keys(void) {
+    for (uint8_t col = 0; col < KEY_COLS; col++) {
+        send_key_event(KEY_ROWS - 1, col, true);
+    }
+    for (uint8_t col = 0; col < KEY_COLS; col++) {
+        send_key_event(KEY_ROWS - 1, col, false);
+    }
+}
+
+// Runs the matrix scan loop, which updates the visualizer once per tick
+static void scan(uint32_t ms) {
+    systime_t ticks = MS2ST(ms);
+    for (systime_t i = 0; i < ticks; i++) {
+        if (typing) {
+            type_keys();
+        }
+        visualizer_update(default_layer_state, layer_state, leds);
+        sim_advance(1);
+    }
+}
+
+static void run_session(void) {
+    visualizer_init();
+    // Wait for the startup animation to finish
+    scan(7000);
+    // Hold down a momentary layer key for a while
+    layer_state = 0x3;
+    scan(3000);
+    layer_state = 0x1;
+    scan(3000);
+    // Tap the layer key, shorter than the color change delay
+    layer_state = 0x3;
+    scan(100);
+    layer_state = 0x1;
+    scan(2000);
+    if (typing) {
+        mash_keys();
+    }
+    // Toggle caps lock
+    leds = 0x2;
+    scan(1000);
+    leds = 0;
+    scan(1000);
+    visualizer_suspend();
+    scan(2000);
+    visualizer_resume();
+    scan(3000);
+}
+
+static bool write_recording(const char* path) {
+    size_t size;
+    const uint8_t* recording = visualizer_get_recording(&size);
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        perror(path);
+        return false;
+    }
+    bool ok = fwrite(recording, 1, size, file) == size;
+    ok = fclose(file) == 0 && ok;
+    if (!ok) {
+        perror(path);
+    }
+    return ok;
+}
+
+static uint8_t* read_file(const char* path, size_t* size) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        perror(path);
+        return NULL;
+    }
+    uint8_t* data = NULL;
+    size_t capacity = 0;
+    *size = 0;
+    while (!feof(file) && !ferror(file)) {
+        if (*size == capacity) {
+            capacity = capacity ? capacity * 2 : 4096;
+            data = realloc(data, capacity);
+        }
+        *size += fread(data + *size, 1, capacity - *size, file);
+    }
+    if (ferror(file)) {
+        perror(path);
+        free(data);
+        data = NULL;
+    }
+    fclose(file);
+    return data;
+}
+
+static double cpu_time_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// Each call is made at its recorded time, and like the matrix scans of the
+// session, takes one tick. The virtual clock jumps over the time in between,
+// so the host time depends only on the work that the visualizer does.
+static bool run_replay(const char* path) {
+    size_t size;
+    uint8_t* data = read_file(path, &size);
+    if (data == NULL) {
+        return false;
+    }
+    visualizer_replay_t replay;
+    if (!visualizer_replay_init(&replay, data, size)) {
+        fprintf(stderr, "%s: not a visualizer recording\n", path);
+        free(data);
+        return false;
+    }
+    uint32_t events = 0;
+    double start = cpu_time_ms();
+    visualizer_init();
+    visualizer_record_event_t event;
+    while (visualizer_replay_next(&replay, &event)) {
+        systime_t time = (uint64_t)event.time * CH_CFG_ST_FREQUENCY / replay.frequency;
+        if ((int32_t)(time - chVTGetSystemTimeX()) > 0) {
+            sim_advance(time - chVTGetSystemTimeX());
+        }
+        switch (event.type) {
+        case VISUALIZER_RECORD_UPDATE:
+            visualizer_update(event.default_layer, event.layer, event.leds);
+            break;
+        case VISUALIZER_RECORD_SUSPEND:
+            visualizer_suspend();
+            break;
+        case VISUALIZER_RECORD_RESUME:
+            visualizer_resume();
+            break;
+        }
+        events++;
+    }
+    sim_advance(1);
+    double cpu_ms = cpu_time_ms() - start;
+    free(data);
+    if (replay.error) {
+        fprintf(stderr, "%s: the recording is truncated or corrupt\n", path);
+        return false;
+    }
+    printf("replay_trace: %s\n", path);
+    printf("replay_events: %u\n", events);
+    // A host time, so it changes from run to run
+    printf("replay_cpu_ms: %.1f\n", cpu_ms);
+    return true;
+}
+
+// The example visualizer uses all the other built-in keyframes
+static const keyframe_t builtin_keyframes[] = {
+    {MS2ST(100), keyframe_set_backlight_color},
+    {MS2ST(100), keyframe_display_layer_bitmap},
+};
+
+static const keyframe_animation_descriptor_t builtin_animation_descriptor = {
+    KEYFRAMES(builtin_keyframes),
+    .loop = false,
+};
+
+static keyframe_animation_t builtin_animation = { .descriptor = &builtin_animation_descriptor };
+
+// Runs the keyframes that the session didn't reach, for the stack report
+static void run_builtin_keyframes(void) {
+    start_keyframe_animation(&builtin_animation);
+    // Wake up the visualizer thread, so that it sees the new animation
+    leds = 0x2;
+    scan(500);
+    leds = 0;
+    scan(500);
+}
+
+// The times are host times, so unlike the rest of the output they change from
+// run to run
+static void print_profile(void) {
+    const visualizer_profile_t* profile = visualizer_get_profile();
+    double us_per_tick = 1000000.0 / profile->counter_frequency;
+    printf("profile_busy_us: %.1f\n", profile->busy * us_per_tick);
+    printf("profile_max_busy_us: %.1f\n", profile->max_busy * us_per_tick);
+    printf("profile_yields: %u\n", profile->yields);
+    printf("profile_untracked_calls: %u\n", profile->untracked_calls);
+    for (uint32_t i = 0; i < profile->num_functions; i++) {
+        const visualizer_frame_profile_t* p = &profile->functions[i];
+        char name[128];
+        sim_function_name((sim_function_t)p->function, name, sizeof(name));
+        printf("profile %s: calls %u min %.2f us max %.2f us mean %.2f us\n", name, p->calls,
+                p->min * us_per_tick, p->max * us_per_tick, (double)p->total / p->calls * us_per_tick);
+        printf("profile %s histogram:", name);
+        for (int bucket = 0; bucket < VISUALIZER_PROFILE_BUCKETS; bucket++) {
+            if (p->histogram[bucket]) {
+                printf(" %lu:%u", 1ul << bucket, p->histogram[bucket]);
+            }
+        }
+        printf("\n");
+    }
+}
+
+// The trace uses the virtual clock, so the latencies are whole ticks
+static void print_trace(bool print_events) {
+    static visualizer_trace_t trace;
+    visualizer_get_trace(&trace);
+    double ms_per_tick = 1000.0 / trace.counter_frequency;
+    visualizer_trace_latency_t latencies[VISUALIZER_TRACE_NUM_STAGES];
+    visualizer_trace_analyze(&trace, latencies);
+    for (uint8_t stage = 0; stage < VISUALIZER_TRACE_NUM_STAGES; stage++) {
+        const visualizer_trace_latency_t* l = &latencies[stage];
+        printf("trace %s: changes %u p50 %.0f ms p90 %.0f ms p99 %.0f ms max %.0f ms\n",
+                visualizer_trace_stage_name(stage), l->count, l->p50 * ms_per_tick,
+                l->p90 * ms_per_tick, l->p99 * ms_per_tick, l->max * ms_per_tick);
+    }
+    if (print_events) {
+        for (size_t i = 0; i < trace.num_events; i++) {
+            const visualizer_trace_event_t* e = &trace.events[i];
+            printf("trace_event %.0f %u %s\n", e->time * ms_per_tick, e->id,
+                    visualizer_trace_stage_name(e->stage));
+        }
+    }
+}
+
+static void print_lcd_work(void) {
+    const sim_lcd_work_t* work;
+    int num_work = sim_lcd_get_work(&work);
+    for (int i = 0; i < num_work; i++) {
+        const sim_lcd_work_t* w = &work[i];
+        char name[128] = "outside_frames";
+        if (w->function) {
+            sim_function_name(w->function, name, sizeof(name));
+        }
+        printf("lcd_work %s: pixels_written %u unchanged %u (%.1f%%) flushes %u flushed_bytes %u\n",
+                name, w->pixels_written, w->pixels_unchanged,
+                w->pixels_written ? 100.0 * w->pixels_unchanged / w->pixels_written : 0.0,
+                w->flushes, w->flushed_bytes);
+    }
+}
+
+static void print_serial_link_stats(const char* name, const sim_serial_link_stats_t* stats, uint32_t duration_ms) {
+    printf("%s_frames_per_sec: %.1f\n", name, stats->frames * 1000.0 / duration_ms);
+    printf("%s_fixed_bytes_per_sec: %.1f\n", name, stats->fixed_bytes * 1000.0 / duration_ms);
+    printf("%s_variable_bytes_per_sec: %.1f\n", name, stats->variable_bytes * 1000.0 / duration_ms);
+    printf("%s_diverged_ms: %u\n", name, stats->diverged_ms);
+    printf("%s_max_diverged_ms: %u\n", name, stats->max_diverged_ms);
+}
+
+static void run_serial_link(unsigned loss_percent) {
+    const uint32_t duration_ms = 600000;
+    sim_serial_link_stats_t full;
+    sim_serial_link_stats_t compact;
+    sim_run_serial_link(duration_ms, loss_percent, &full, &compact);
+    printf("serial_link_loss_percent: %u\n", loss_percent);
+    print_serial_link_stats("full", &full, duration_ms);
+    print_serial_link_stats("compact", &compact, duration_ms);
+}
+
+static void run_clock_sync(unsigned loss_percent, const sim_clock_sync_config_t* config) {
+    const uint32_t duration_ms = 600000;
+    sim_clock_sync_stats_t stats;
+    sim_run_clock_sync(duration_ms, loss_percent, config, &stats);
+    printf("clock_sync_loss_percent: %u\n", loss_percent);
+    printf("clock_sync_link_delay_ms: %u\n", config->link_delay_ms);
+    printf("clock_sync_jitter_ms: %u\n", config->jitter_ms);
+    printf("clock_sync_drift_ppm: %d\n", config->drift_ppm);
+    printf("clock_sync_estimated_drift_ppm: %d\n", stats.drift_ppm);
+    printf("clock_sync_resyncs: %u\n", stats.resyncs);
+    printf("synced_mean_phase_error_ms: %.2f\n", (double)stats.synced_error_total / stats.samples);
+    printf("synced_max_phase_error_ms: %u\n", stats.synced_max_error);
+    printf("local_mean_phase_error_ms: %.2f\n", (double)stats.local_error_total / stats.samples);
+    printf("local_max_phase_error_ms: %u\n", stats.local_max_error);
+}
+
+int main(int argc, char** argv) {
+    bool print_lcd = false;
+    bool serial_link = false;
+    bool clock_sync = false;
+    sim_clock_sync_config_t clock_sync_config = {
+        .link_delay_ms = 2,
+        .jitter_ms = 3,
+        .drift_ppm = 200,
+    };
+    bool stack_report = false;
+    bool profile = false;
+    bool trace = false;
+    bool trace_events = false;
+    const char* record_path = NULL;
+    const char* replay_path = NULL;
+    bool overdraw = false;
+    unsigned loss_percent = 5;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--print-lcd") == 0) {
+            print_lcd = true;
+        }
+        else if (strcmp(argv[i], "--stack-report") == 0) {
+            stack_report = true;
+        }
+        else if (strcmp(argv[i], "--profile") == 0) {
+            profile = true;
+        }
+        else if (strcmp(argv[i], "--trace") == 0) {
+            trace = true;
+        }
+        else if (strcmp(argv[i], "--trace-events") == 0) {
+            trace = true;
+            trace_events = true;
+        }
+        else if (strcmp(argv[i], "--serial-link") == 0) {
+            serial_link = true;
+        }
+        else if (strcmp(argv[i], "--clock-sync") == 0) {
+            clock_sync = true;
+        }
+        else if (strcmp(argv[i], "--overdraw") == 0) {
+            overdraw = true;
+        }
+        else if (strcmp(argv[i], "--typing") == 0) {
+            typing = true;
+        }
+        else if (strncmp(argv[i], "--dump-frames=", 14) == 0) {
+            sim_lcd_dump_frames(argv[i] + 14);
+        }
+        else if (strncmp(argv[i], "--record=", 9) == 0) {
+            record_path = argv[i] + 9;
+        }
+        else if (strncmp(argv[i], "--replay=", 9) == 0) {
+            replay_path = argv[i] + 9;
+        }
+        else if (strncmp(argv[i], "--loss=", 7) == 0) {
+            loss_percent = atoi(argv[i] + 7);
+        }
+        else if (strncmp(argv[i], "--delay=", 8) == 0) {
+            clock_sync_config.link_delay_ms = atoi(argv[i] + 8);
+        }
+        else if (strncmp(argv[i], "--jitter=", 9) == 0) {
+            clock_sync_config.jitter_ms = atoi(argv[i] + 9);
+        }
+        else if (strncmp(argv[i], "--drift=", 8) == 0) {
+            clock_sync_config.drift_ppm = atoi(argv[i] + 8);
+        }
+        else {
+            fprintf(stderr, "Usage: %s [--print-lcd] [--stack-report] [--profile] [--trace] [--trace-events]\n"
+                    "       [--overdraw] [--dump-frames=directory] [--typing] [--record=file | --replay=file]\n"
+                    "       [--serial-link [--loss=percent]]\n"
+                    "       [--clock-sync [--loss=percent] [--delay=ms] [--jitter=ms] [--drift=ppm]]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (serial_link) {
+        run_serial_link(loss_percent);
+        return 0;
+    }
+    if (clock_sync) {
+        run_clock_sync(loss_percent, &clock_sync_config);
+        return 0;
+    }
+
+    if (stack_report) {
+        sim_frame_profile_enable();
+    }
+    if (replay_path) {
+        if (!run_replay(replay_path)) {
+            return 1;
+        }
+    }
+    else {
+        run_session();
+        if (record_path && !write_recording(record_path)) {
+            return 1;
+        }
+    }
+    if (stack_report) {
+        run_builtin_keyframes();
+    }
+
+    sim_kernel_stats_t kernel_stats;
+    sim_get_kernel_stats(&kernel_stats);
+    sim_lcd_stats_t lcd_stats;
+    sim_get_lcd_stats(&lcd_stats);
+    const sim_backlight_write_t* last_write = sim_backlight_get_write(0);
+
+    printf("virtual_time_ms: %lu\n", (unsigned long)ST2MS(chVTGetSystemTimeX()));
+    printf("thread_switches: %u\n", kernel_stats.thread_switches);
+    printf("visualizer_wakeups: %u\n", visualizer_get_profile()->wakeups);
+    printf("first_scan_ms: %lu\n", (unsigned long)ST2MS(visualizer_get_profile()->first_scan_time));
+    printf("first_frame_ms: %lu\n", (unsigned long)ST2MS(visualizer_get_profile()->first_frame_time));
+    printf("lcd_flushes: %u\n", lcd_stats.flushes);
+    printf("lcd_partial_flushes: %u\n", lcd_stats.partial_flushes);
+    printf("lcd_flushed_bytes: %u\n", lcd_stats.flushed_bytes);
+    printf("lcd_async_flushes: %u\n", lcd_stats.async_flushes);
+    printf("lcd_torn_flushes: %u\n", lcd_stats.torn_flushes);
+    printf("lcd_pixels_written: %u\n", lcd_stats.pixels_written);
+    printf("lcd_pixels_unchanged: %u\n", lcd_stats.pixels_unchanged);
+    printf("lcd_clears: %u\n", lcd_stats.clears);
+    printf("lcd_powered: %d\n", lcd_stats.powered);
+#if LCD_FRAME_CACHE_SIZE > 0
+    lcd_frame_cache_stats_t cache_stats;
+    lcd_display_get_cache_stats(&cache_stats);
+    printf("lcd_frame_cache_entries: %u\n", cache_stats.entries);
+    printf("lcd_frame_cache_hits: %u\n", cache_stats.hits);
+    printf("lcd_frame_cache_misses: %u\n", cache_stats.misses);
+    printf("lcd_frame_cache_evictions: %u\n", cache_stats.evictions);
+#endif
+    size_t stack_used = visualizer_get_stack_high_water_mark();
+    if (sim_frame_profile_stack_peak() > stack_used) {
+        stack_used = sim_frame_profile_stack_peak();
+    }
+    printf("stack_size: %zu\n", visualizer_get_stack_size());
+    printf("stack_used: %zu\n", stack_used);
+    printf("backlight_writes: %u\n", sim_backlight_get_write_count());
+    if (last_write) {
+        printf("backlight_rgb: %u %u %u\n", last_write->r, last_write->g, last_write->b);
+    }
+    if (stack_report) {
+        sim_frame_profile_print(stdout);
+    }
+    if (profile) {
+        print_profile();
+    }
+    if (trace) {
+        print_trace(trace_events);
+    }
+    if (overdraw) {
+        print_lcd_work();
+    }
+    if (typing) {
+        // The events sent during the startup animation and suspend are
+        // dropped by the visualizer, without counting them
+        printf("key_events_sent: %u\n", key_events_sent);
+        printf("key_events_received: %u\n", visualizer_get_profile()->key_events);
+        printf("key_event_batches: %u\n", visualizer_get_profile()->key_event_batches);
+        printf("key_event_overflows: %u\n", visualizer_get_key_event_overflows());
+    }
+    if (print_lcd) {
+        sim_lcd_print(stdout);
+    }
+    return 0;
+}
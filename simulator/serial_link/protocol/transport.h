@@ -0,0 +1,52 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Fred Sundvik
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// Host stand-in for the remote objects of the TMK serial link transport. The
+// objects are moved between the halves by the simulation, see
+// serial_link_sim.h.
+
+#ifndef SIMULATOR_SERIAL_LINK_TRANSPORT_H
+#define SIMULATOR_SERIAL_LINK_TRANSPORT_H
+#include "serial_link_sim.h"
+
+typedef sim_remote_object_t remote_object_t;
+
+#define MASTER_TO_ALL_SLAVES_OBJECT(name, type) \
+    _Static_assert(sizeof(type) <= SIM_REMOTE_OBJECT_MAX_SIZE, "Too big remote object"); \
+    static remote_object_t remote_object_##name = { .size = sizeof(type) }; \
+    static inline type* begin_write_##name(void) { \
+        return sim_remote_object_begin_write(&remote_object_##name); \
+    } \
+    static inline void end_write_##name(void) { \
+        sim_remote_object_end_write(&remote_object_##name); \
+    } \
+    static inline type* read_##name(void) { \
+        return sim_remote_object_read(&remote_object_##name); \
+    }
+
+#define REMOTE_OBJECT(name) (&remote_object_##name)
+
+void add_remote_objects(remote_object_t** remote_objects, uint32_t num_remote_objects);
+
+#endif /* SIMULATOR_SERIAL_LINK_TRANSPORT_H */
@@ -0,0 +1,379 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Fred Sundvik
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// The status traffic between the halves of a split keyboard. The halves are
+// instances of visualizer.c built with the serial link, see link_node.c, and
+// the remote objects that the master writes are passed to the slave here,
+// with the losses and delays of the link.
+
+#include "simulator.h"
+#include "serial_link_sim.h"
+#include "clock_sync.h"
+#include <stdlib.h>
+#include <string.h>
+
+void* sim_remote_object_begin_write(sim_remote_object_t* object) {
+    return object->write_buffer;
+}
+
+void sim_remote_object_end_write(sim_remote_object_t* object) {
+    object->written = true;
+}
+
+void* sim_remote_object_read(sim_remote_object_t* object) {
+    if (!object->received) {
+        return NULL;
+    }
+    object->received = false;
+    return object->read_buffer;
+}
+
+static void deliver_object(sim_remote_object_t* object, const uint8_t* data) {
+    memcpy(object->read_buffer, data, object->size);
+    object->received = true;
+}
+
+// The script, the lost frames and the delays use separate xorshift32
+// generators, so every run sends the same sequence of changes, whatever the
+// loss rate
+static uint32_t script_random;
+
+#define LOSS_RANDOM_SEED 0x9E3779B9
+#define DELAY_RANDOM_SEED 0x2545F491
+
+typedef struct {
+    visualizer_keyboard_status_t master;
+    uint32_t next_event;
+    uint32_t layer_release;
+} script_t;
+
+static uint32_t random_next(uint32_t* state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+static uint32_t random_range(uint32_t min, uint32_t max) {
+    return min + random_next(&script_random) % (max - min + 1);
+}
+
+static bool frame_lost(uint32_t* loss_random, unsigned loss_percent) {
+    return random_next(loss_random) % 100 < loss_percent;
+}
+
+static systime_t master_clock(void) {
+    return chVTGetSystemTimeX();
+}
+
+// A master and a slave, and the link between them
+typedef struct {
+    sim_link_node_t* master;
+    sim_link_node_t* slave;
+    // The compact objects start with the size of the packet
+    bool compact;
+    uint32_t loss_random;
+    uint32_t diverged_since;
+    bool diverged;
+    sim_serial_link_stats_t* stats;
+} link_t;
+
+static void init_link(link_t* link, sim_link_node_t* master, sim_link_node_t* slave, bool compact,
+        sim_serial_link_stats_t* stats) {
+    memset(stats, 0, sizeof(*stats));
+    memset(link, 0, sizeof(*link));
+    link->master = master;
+    link->slave = slave;
+    link->compact = compact;
+    link->loss_random = LOSS_RANDOM_SEED;
+    link->stats = stats;
+    master->clock = master_clock;
+    master->slave = false;
+    master->init();
+    slave->clock = master_clock;
+    slave->slave = true;
+    slave->init();
+}
+
+// Counts the object that the master wrote, and returns it, or NULL if it
+// didn't write one
+static const uint8_t* send_object(link_t* link) {
+    sim_remote_object_t* object = link->master->object;
+    if (!object->written) {
+        return NULL;
+    }
+    object->written = false;
+    link->stats->frames++;
+    link->stats->fixed_bytes += object->size;
+    link->stats->variable_bytes += link->compact ? 1 + object->write_buffer[0] : object->size;
+    return object->write_buffer;
+}
+
+static void update_master(link_t* link, const visualizer_keyboard_status_t* status) {
+    link->master->update(status->default_layer, status->layer, status->leds);
+}
+
+// The slave ignores the status it's given, it reads the one from the master
+static void update_slave(link_t* link) {
+    link->slave->update(0, 0, 0);
+}
+
+static void check_divergence(link_t* link, uint32_t time) {
+    bool diverged = memcmp(&link->slave->status, &link->master->status, sizeof(visualizer_keyboard_status_t)) != 0;
+    if (diverged) {
+        link->stats->diverged_ms++;
+        if (!link->diverged) {
+            link->diverged_since = time;
+        }
+        uint32_t length = time - link->diverged_since + 1;
+        if (length > link->stats->max_diverged_ms) {
+            link->stats->max_diverged_ms = length;
+        }
+    }
+    link->diverged = diverged;
+}
+
+static void init_script(script_t* script) {
+    script_random = 0x12345678;
+    memset(script, 0, sizeof(*script));
+    script->master.layer = 1;
+    script->master.default_layer = 1;
+}
+
+// Momentary layer keys, mixed with caps lock toggles and an occasional
+// default layer change
+static void run_script(script_t* script, uint32_t time) {
+    visualizer_keyboard_status_t* master = &script->master;
+    if (script->layer_release && time >= script->layer_release) {
+        master->layer = master->default_layer;
+        script->layer_release = 0;
+    }
+    if (time >= script->next_event) {
+        uint32_t event = random_range(0, 99);
+        if (event < 70) {
+            master->layer = master->default_layer | (1u << random_range(1, 31));
+            script->layer_release = time + random_range(50, 1500);
+        }
+        else if (event < 95) {
+            master->leds ^= 0x2;
+        }
+        else {
+            master->default_layer = 1u << random_range(0, 2);
+            master->layer = master->default_layer;
+        }
+        script->next_event = time + random_range(100, 2000);
+    }
+}
+
+void sim_run_serial_link(uint32_t duration_ms, unsigned loss_percent,
+        sim_serial_link_stats_t* full, sim_serial_link_stats_t* compact) {
+    link_t links[2];
+    init_link(&links[0], &sim_full_master_node, &sim_full_slave_node, false, full);
+    init_link(&links[1], &sim_compact_master_node, &sim_compact_slave_node, true, compact);
+
+    script_t script;
+    init_script(&script);
+    for (uint32_t time = 0; time < duration_ms; time++) {
+        run_script(&script, time);
+        for (int i = 0; i < 2; i++) {
+            link_t* link = &links[i];
+            update_master(link, &script.master);
+            const uint8_t* object = send_object(link);
+            if (object && !frame_lost(&link->loss_random, loss_percent)) {
+                deliver_object(link->slave->object, object);
+            }
+            update_slave(link);
+        }
+        // The visualizer threads see the new status
+        sim_advance(1);
+        for (int i = 0; i < 2; i++) {
+            check_divergence(&links[i], time);
+        }
+    }
+}
+
+// The clock sync measurement has a master and a slave half, whose user code
+// restarts a looping animation on every status change, see link_node.c. The
+// slave runs the animations on the synchronized clock, and is compared to a
+// pair without VISUALIZER_CLOCK_SYNC, which starts the animations on the
+// local clock of the slave when it receives the change. Both pairs get the
+// same status changes, and the same losses and delays.
+
+#define PACKET_QUEUE_SIZE 64
+
+uint32_t sim_clock_sync_link_delay;
+
+typedef struct {
+    uint32_t arrival;
+    // The number of status changes on the master when it was sent, it's not
+    // part of the packet, it just tells which animation the slave starts
+    uint32_t change;
+    uint8_t data[SIM_REMOTE_OBJECT_MAX_SIZE];
+} queued_packet_t;
+
+typedef struct {
+    sim_link_node_t* master;
+    sim_link_node_t* slave;
+    queued_packet_t packets[PACKET_QUEUE_SIZE];
+    uint32_t head;
+    uint32_t tail;
+    uint32_t last_arrival;
+    uint32_t loss_random;
+    uint32_t delay_random;
+    // The change of the last packet that the slave received, and of the
+    // animation that it's running
+    uint32_t received_change;
+    uint32_t slave_changes;
+    uint32_t change;
+} delayed_link_t;
+
+static int32_t slave_drift_ppm;
+
+// The crystal of the slave runs at a slightly different rate, and it was
+// started at a different time
+static systime_t drifting_clock(void) {
+    uint32_t time = chVTGetSystemTimeX();
+    return 123456 + time + (int32_t)((int64_t)time * slave_drift_ppm / 1000000);
+}
+
+static void init_delayed_link(delayed_link_t* link, sim_link_node_t* master, sim_link_node_t* slave) {
+    memset(link, 0, sizeof(*link));
+    link->master = master;
+    link->slave = slave;
+    link->loss_random = LOSS_RANDOM_SEED;
+    link->delay_random = DELAY_RANDOM_SEED;
+    master->clock = master_clock;
+    master->slave = false;
+    master->init();
+    slave->clock = drifting_clock;
+    slave->slave = true;
+    slave->init();
+}
+
+static void send_delayed(delayed_link_t* link, const sim_clock_sync_config_t* config, unsigned loss_percent,
+        uint32_t change, uint32_t time) {
+    sim_remote_object_t* object = link->master->object;
+    if (!object->written) {
+        return;
+    }
+    object->written = false;
+    queued_packet_t* packet = &link->packets[link->head % PACKET_QUEUE_SIZE];
+    packet->change = change;
+    memcpy(packet->data, object->write_buffer, object->size);
+    // The link delivers the packets in order
+    uint32_t jitter = config->jitter_ms ? random_next(&link->delay_random) % (config->jitter_ms + 1) : 0;
+    uint32_t arrival = time + config->link_delay_ms + jitter;
+    packet->arrival = arrival > link->last_arrival ? arrival : link->last_arrival;
+    link->last_arrival = packet->arrival;
+    if (!frame_lost(&link->loss_random, loss_percent) && link->head - link->tail < PACKET_QUEUE_SIZE) {
+        link->head++;
+    }
+}
+
+// Like the transport, the slave only reads the latest of the packets that
+// arrive at the same time
+static void receive_delayed(delayed_link_t* link, uint32_t time) {
+    while (link->tail != link->head && link->packets[link->tail % PACKET_QUEUE_SIZE].arrival <= time) {
+        const queued_packet_t* packet = &link->packets[link->tail % PACKET_QUEUE_SIZE];
+        deliver_object(link->slave->object, packet->data);
+        link->received_change = packet->change;
+        link->tail++;
+    }
+}
+
+// Called after the visualizer threads have run, a restarted animation on the
+// slave is the one of the last change it received
+static void update_slave_change(delayed_link_t* link) {
+    if (link->slave->changes != link->slave_changes) {
+        link->slave_changes = link->slave->changes;
+        link->change = link->received_change;
+    }
+}
+
+static uint32_t phase_error(int32_t position1, int32_t position2) {
+    uint32_t error = abs(position1 - position2) % SIM_LINK_ANIMATION_PERIOD;
+    return error <= SIM_LINK_ANIMATION_PERIOD / 2 ? error : SIM_LINK_ANIMATION_PERIOD - error;
+}
+
+static void add_phase_error(uint32_t error, uint64_t* total, uint32_t* max) {
+    *total += error;
+    if (error > *max) {
+        *max = error;
+    }
+}
+
+void sim_run_clock_sync(uint32_t duration_ms, unsigned loss_percent, const sim_clock_sync_config_t* config,
+        sim_clock_sync_stats_t* stats) {
+    memset(stats, 0, sizeof(*stats));
+    slave_drift_ppm = config->drift_ppm;
+    sim_clock_sync_link_delay = config->link_delay_ms;
+
+    script_t script;
+    init_script(&script);
+    const visualizer_keyboard_status_t* master = &script.master;
+    visualizer_keyboard_status_t previous = *master;
+    delayed_link_t synced;
+    delayed_link_t local;
+    init_delayed_link(&synced, &sim_sync_master_node, &sim_sync_slave_node);
+    init_delayed_link(&local, &sim_compact_master_node, &sim_compact_slave_node);
+    uint32_t master_change = 0;
+
+    for (uint32_t time = 0; time < duration_ms; time++) {
+        run_script(&script, time);
+        if (memcmp(master, &previous, sizeof(*master)) != 0) {
+            master_change++;
+        }
+        previous = *master;
+
+        delayed_link_t* links[] = {&synced, &local};
+        for (int i = 0; i < 2; i++) {
+            delayed_link_t* link = links[i];
+            link->master->update(master->default_layer, master->layer, master->leds);
+            send_delayed(link, config, loss_percent, master_change, time);
+            receive_delayed(link, time);
+            link->slave->update(0, 0, 0);
+        }
+        sim_advance(1);
+        update_slave_change(&synced);
+        update_slave_change(&local);
+
+        // Until the slave receives a change, it's still running the previous
+        // animation, that delay is the same with both clocks
+        sim_link_node_t* master_node = synced.master;
+        if (master_node->position >= 0 && synced.slave->position >= 0 && local.slave->position >= 0 &&
+                synced.change == master_change && local.change == master_change) {
+            stats->samples++;
+            add_phase_error(phase_error(master_node->position, synced.slave->position),
+                    &stats->synced_error_total, &stats->synced_max_error);
+            add_phase_error(phase_error(local.master->position, local.slave->position),
+                    &stats->local_error_total, &stats->local_max_error);
+        }
+    }
+    clock_sync_t sync;
+    synced.slave->get_clock_sync(&sync);
+    // The drift of the offset to the master is the opposite of the drift of
+    // the slave
+    stats->drift_ppm = -(int32_t)(((int64_t)sync.drift * 1000000) >> CLOCK_SYNC_DRIFT_SHIFT);
+    stats->resyncs = sync.generation > 1 ? sync.generation - 1 : 0;
+}
@@ -0,0 +1,98 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Fred Sundvik
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// The serial link between the halves of a split keyboard in the host
+// simulation. Each half is a separate instance of visualizer.c, built with
+// USE_SERIAL_LINK, see link_node.c. The simulation moves the remote objects
+// from the master to the slave, with the losses and delays of the link.
+
+#ifndef SIMULATOR_SERIAL_LINK_SIM_H
+#define SIMULATOR_SERIAL_LINK_SIM_H
+#include "ch.h"
+#include "visualizer.h"
+#include "clock_sync.h"
+
+// The stand-in of a remote object of the serial link transport, see
+// serial_link/protocol/transport.h
+#define SIM_REMOTE_OBJECT_MAX_SIZE 32
+
+typedef struct {
+    uint8_t size;
+    // Set when the master has written the object, the simulation clears it
+    // when it sends the object
+    bool written;
+    // Set when the simulation delivers the object to the slave, and cleared
+    // when the slave reads it
+    bool received;
+    uint8_t write_buffer[SIM_REMOTE_OBJECT_MAX_SIZE];
+    uint8_t read_buffer[SIM_REMOTE_OBJECT_MAX_SIZE];
+} sim_remote_object_t;
+
+void* sim_remote_object_begin_write(sim_remote_object_t* object);
+void sim_remote_object_end_write(sim_remote_object_t* object);
+// Returns NULL when nothing new has been received since the last read, like
+// the real transport
+void* sim_remote_object_read(sim_remote_object_t* object);
+
+// One half of the keyboard. The simulation sets the first fields before
+// calling init, and the node fills in the rest.
+typedef struct {
+    // The system time of the half
+    systime_t (*clock)(void);
+    // The slave reads the status from the serial link, the master sends it
+    bool slave;
+
+    void (*init)(void);
+    void (*update)(uint32_t default_state, uint32_t state, uint32_t leds);
+    // The status object registered by the visualizer
+    sim_remote_object_t* object;
+    // The status that the user code of the visualizer saw last
+    visualizer_keyboard_status_t status;
+    // The user code restarts a looping animation of SIM_LINK_ANIMATION_PERIOD
+    // ticks on every status change. These are the number of changes, and the
+    // position of the animation at its last update, negative before the first
+    // change.
+    uint32_t changes;
+    int32_t position;
+    // Copies the clock estimate of the visualizer, NULL without
+    // VISUALIZER_CLOCK_SYNC
+    void (*get_clock_sync)(clock_sync_t* sync);
+} sim_link_node_t;
+
+#define SIM_LINK_ANIMATION_PERIOD 1000
+
+// The VISUALIZER_CLOCK_SYNC_LINK_DELAY of the sync nodes, see the Makefile
+extern uint32_t sim_clock_sync_link_delay;
+
+// The nodes of each build, see the Makefile. The full ones send the full
+// status every 10 ms, the compact ones use VISUALIZER_COMPACT_STATUS, and the
+// sync ones VISUALIZER_CLOCK_SYNC as well.
+extern sim_link_node_t sim_full_master_node;
+extern sim_link_node_t sim_full_slave_node;
+extern sim_link_node_t sim_compact_master_node;
+extern sim_link_node_t sim_compact_slave_node;
+extern sim_link_node_t sim_sync_master_node;
+extern sim_link_node_t sim_sync_slave_node;
+
+#endif /* SIMULATOR_SERIAL_LINK_SIM_H */
@@ -0,0 +1,194 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Fred Sundvik
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// Control interface of the host simulation. The simulation driver plays the
+// role of the keyboard main loop, it calls the normal visualizer API and
+// advances the virtual clock in between.
+
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "ch.h"
+
+// Lets all ready threads run until they block, without moving the clock
+void sim_run_pending(void);
+// Advances the virtual clock by the given number of ticks. Threads are run
+// whenever they become ready, at the virtual time at which that happens, so
+// the result doesn't depend on how fast the host is
+void sim_advance(systime_t ticks);
+
+typedef struct {
+    // Number of times a simulated thread was switched in
+    uint32_t thread_switches;
+} sim_kernel_stats_t;
+
+void sim_get_kernel_stats(sim_kernel_stats_t* stats);
+
+// Fills the stack of the current thread below the caller with the value, so
+// that sim_stack_used can tell how deep the following code goes
+void sim_stack_paint(uint8_t value);
+// Returns the used stack of the current thread in bytes, counted from the
+// top down to the deepest byte that doesn't have the fill value
+size_t sim_stack_used(uint8_t value);
+
+// Per frame function profiling, through the VISUALIZER_FRAME_BEGIN and
+// VISUALIZER_FRAME_END hooks in config.h. Nothing is measured until it's
+// enabled.
+typedef void (*sim_function_t)(void);
+void sim_frame_begin(sim_function_t function);
+void sim_frame_end(sim_function_t function);
+void sim_frame_profile_enable(void);
+// The frame function that is running, or NULL
+sim_function_t sim_frame_current(void);
+// The peak stack usage seen during the profiling, including the code outside
+// of the frame functions
+size_t sim_frame_profile_stack_peak(void);
+// Prints the profile of each frame function, resolving the names of the
+// functions with addr2line
+void sim_frame_profile_print(FILE* out);
+// Resolves the name of a function with addr2line, or formats the address if
+// that fails
+void sim_function_name(sim_function_t function, char* name, size_t size);
+
+// The in-memory LCD
+#define SIM_LCD_WIDTH 128
+#define SIM_LCD_HEIGHT 32
+
+typedef struct {
+    uint32_t flushes;
+    uint32_t partial_flushes;
+    uint32_t clears;
+    // The number of bytes sent to the display, assuming a monochrome
+    // controller where each byte holds a column of 8 pixels
+    uint32_t flushed_bytes;
+    // Transfers started with GDISP_CONTROL_LCD_FLUSH_START, and the ones that
+    // were started while the previous one was still in progress
+    uint32_t async_flushes;
+    uint32_t torn_flushes;
+    // The pixels that the drawing wrote, and the ones of them that already
+    // had the written value
+    uint32_t pixels_written;
+    uint32_t pixels_unchanged;
+    bool powered;
+} sim_lcd_stats_t;
+
+void sim_get_lcd_stats(sim_lcd_stats_t* stats);
+
+// The drawing and flushing work, attributed to the frame function that did
+// it, or to NULL when it was done outside of them. The flushed bytes of an
+// asynchronous flush are counted when it's started.
+#define SIM_MAX_LCD_WORK 32
+
+typedef struct {
+    sim_function_t function;
+    uint32_t pixels_written;
+    uint32_t pixels_unchanged;
+    uint32_t flushes;
+    uint32_t flushed_bytes;
+} sim_lcd_work_t;
+
+// Returns the number of entries, and the entries in work
+int sim_lcd_get_work(const sim_lcd_work_t** work);
+// Writes every flushed frame as a PBM image to the directory, numbered from
+// zero. The uGFX flushes and the completed asynchronous transfers are each a
+// frame, and so is every partial flush.
+void sim_lcd_dump_frames(const char* directory);
+// Called through LCD_DISPLAY_FRAMEBUFFER_WRITE before lcd_display writes the
+// area directly into the framebuffer
+void sim_lcd_framebuffer_write(int x, int y, int cx, int cy);
+// Returns true if the pixel is drawn in the foreground (black) color
+bool sim_lcd_get_pixel(int x, int y);
+// Prints the last flushed frame as ascii art
+void sim_lcd_print(FILE* out);
+
+// The recorded backlight PWM writes
+typedef struct {
+    systime_t time;
+    uint16_t r;
+    uint16_t g;
+    uint16_t b;
+} sim_backlight_write_t;
+
+#define SIM_BACKLIGHT_LOG_SIZE 1024
+
+uint32_t sim_backlight_get_write_count(void);
+// Returns one of the last SIM_BACKLIGHT_LOG_SIZE writes, age 0 is the most
+// recent one. Returns NULL if the write is not available
+const sim_backlight_write_t* sim_backlight_get_write(uint32_t age);
+
+typedef struct {
+    uint32_t frames;
+    // The payload bytes, for a transport with fixed size objects and for one
+    // that sends only the used part of the object
+    uint32_t fixed_bytes;
+    uint32_t variable_bytes;
+    // How long the slave status was different from the master status, in
+    // total and the longest single stretch
+    uint32_t diverged_ms;
+    uint32_t max_diverged_ms;
+} sim_serial_link_stats_t;
+
+// Sends a scripted sequence of keyboard status changes from a master to a
+// slave instance of the visualizer, over a simulated link that drops the given
+// percentage of the frames. The old scheme, which sends the full status every
+// 10 ms, is written to full and the compact change only scheme to compact
+void sim_run_serial_link(uint32_t duration_ms, unsigned loss_percent,
+        sim_serial_link_stats_t* full, sim_serial_link_stats_t* compact);
+
+typedef struct {
+    // The fixed part of the delay of the packets, which the slave also
+    // compensates for, and the maximum random delay on top of that
+    uint32_t link_delay_ms;
+    uint32_t jitter_ms;
+    // How much faster the crystal of the slave runs, in parts per million
+    int32_t drift_ppm;
+} sim_clock_sync_config_t;
+
+typedef struct {
+    // The milliseconds when both halves were running the animation of the
+    // same status change
+    uint32_t samples;
+    // The phase error of the animation on the slave, in milliseconds, when
+    // it's run on the synchronized clock, and when it's started on the local
+    // clock when the change is received
+    uint64_t synced_error_total;
+    uint32_t synced_max_error;
+    uint64_t local_error_total;
+    uint32_t local_max_error;
+    // The drift of the slave clock that was estimated at the end
+    int32_t drift_ppm;
+    // How many times the estimate started over after the first time
+    uint32_t resyncs;
+} sim_clock_sync_stats_t;
+
+// Sends the same scripted status changes as sim_run_serial_link over a link
+// with the given delays, from a master to a slave instance of the visualizer
+// that synchronizes its clock to the master, and measures how far apart their
+// animations are
+void sim_run_clock_sync(uint32_t duration_ms, unsigned loss_percent, const sim_clock_sync_config_t* config,
+        sim_clock_sync_stats_t* stats);
+
+#endif /* SIMULATOR_H */
@@ -0,0 +1,84 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Fred Sundvik
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "status_link.h"
+#include "varint.h"
+
+uint8_t status_link_encode(uint32_t fields, const visualizer_keyboard_status_t* status,
+        const status_link_time_t* time, uint8_t* buffer) {
+    fields &= STATUS_LINK_ALL_FIELDS | STATUS_LINK_TIME;
+    uint8_t* p = buffer;
+    *p++ = fields | (status->suspended ? STATUS_LINK_SUSPENDED : 0);
+    if (fields & VISUALIZER_CHANGED_LAYER) {
+        p = varint_encode(p, status->layer);
+    }
+    if (fields & VISUALIZER_CHANGED_DEFAULT_LAYER) {
+        p = varint_encode(p, status->default_layer);
+    }
+    if (fields & VISUALIZER_CHANGED_LEDS) {
+        p = varint_encode(p, status->leds);
+    }
+    if (fields & STATUS_LINK_TIME) {
+        p = varint_encode(p, time->time);
+        p = varint_encode(p, time->age < STATUS_LINK_MAX_AGE ? time->age : STATUS_LINK_MAX_AGE);
+    }
+    return p - buffer;
+}
+
+bool status_link_decode(const uint8_t* buffer, uint8_t size, visualizer_keyboard_status_t* status,
+        status_link_time_t* time) {
+    const uint8_t* end = buffer + size;
+    if (size == 0 || (buffer[0] & ~(STATUS_LINK_ALL_FIELDS | STATUS_LINK_SUSPENDED | STATUS_LINK_TIME))) {
+        return false;
+    }
+    uint8_t header = *buffer++;
+    visualizer_keyboard_status_t result = *status;
+    if (header & VISUALIZER_CHANGED_LAYER) {
+        buffer = varint_decode(buffer, end, &result.layer);
+    }
+    if (buffer && (header & VISUALIZER_CHANGED_DEFAULT_LAYER)) {
+        buffer = varint_decode(buffer, end, &result.default_layer);
+    }
+    if (buffer && (header & VISUALIZER_CHANGED_LEDS)) {
+        buffer = varint_decode(buffer, end, &result.leds);
+    }
+    status_link_time_t result_time;
+    if (buffer && (header & STATUS_LINK_TIME)) {
+        buffer = varint_decode(buffer, end, &result_time.time);
+        if (buffer) {
+            buffer = varint_decode(buffer, end, &result_time.age);
+        }
+    }
+    if (buffer != end) {
+        return false;
+    }
+    if (header & VISUALIZER_CHANGED_SUSPENDED) {
+        result.suspended = (header & STATUS_LINK_SUSPENDED) ? true : false;
+    }
+    *status = result;
+    if (header & STATUS_LINK_TIME) {
+        *time = result_time;
+    }
+    return true;
+}
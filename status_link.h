@@ -0,0 +1,72 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Fred Sundvik
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef STATUS_LINK_H_
+#define STATUS_LINK_H_
+#include "visualizer.h"
+
+// A compact encoding of the keyboard status, for sending it over the serial
+// link. A packet only contains the requested fields, so it's usually just two
+// or three bytes.
+//
+// The first byte has the VISUALIZER_CHANGED_ bits of the fields in the
+// packet, and STATUS_LINK_SUSPENDED, which is the value of the suspended
+// field. It's followed by the layer, default layer and leds fields, the
+// ones that are in the packet, each as a variable length integer with seven
+// bits per byte, least significant first. With STATUS_LINK_TIME in the first
+// byte, the system time of the master and the age of the status follow last,
+// in the same format.
+
+#define STATUS_LINK_SUSPENDED (1u << 4)
+#define STATUS_LINK_TIME (1u << 5)
+#define STATUS_LINK_ALL_FIELDS (VISUALIZER_CHANGED_LAYER | VISUALIZER_CHANGED_DEFAULT_LAYER | \
+    VISUALIZER_CHANGED_LEDS | VISUALIZER_CHANGED_SUSPENDED)
+#define STATUS_LINK_MAX_STATUS_SIZE (1 + 3 * 5)
+#define STATUS_LINK_MAX_PACKET_SIZE (STATUS_LINK_MAX_STATUS_SIZE + 5 + 2)
+// Older status changes are sent with this age
+#define STATUS_LINK_MAX_AGE 0x3FFF
+
+#define STATUS_LINK_HAS_TIME(buffer, size) ((size) > 0 && ((buffer)[0] & STATUS_LINK_TIME))
+
+typedef struct {
+    // The system time of the master when the packet was sent
+    uint32_t time;
+    // How long before that the status changed, at most STATUS_LINK_MAX_AGE
+    uint32_t age;
+} status_link_time_t;
+
+// Encodes the fields of status given by the VISUALIZER_CHANGED_ bits into the
+// buffer, which needs to have room for STATUS_LINK_MAX_PACKET_SIZE bytes, or
+// STATUS_LINK_MAX_STATUS_SIZE without the time. The time is added when the
+// fields include STATUS_LINK_TIME, otherwise it can be NULL. Returns the size
+// of the packet.
+uint8_t status_link_encode(uint32_t fields, const visualizer_keyboard_status_t* status,
+        const status_link_time_t* time, uint8_t* buffer);
+// Updates the fields of status that are in the packet, and the time if the
+// packet has one, see STATUS_LINK_HAS_TIME. Returns false, without touching
+// either, if the packet is malformed.
+bool status_link_decode(const uint8_t* buffer, uint8_t size, visualizer_keyboard_status_t* status,
+        status_link_time_t* time);
+
+#endif /* STATUS_LINK_H_ */
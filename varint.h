@@ -0,0 +1,66 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Fred Sundvik
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef VARINT_H_
+#define VARINT_H_
+#include <stdint.h>
+
+// The variable length integers of the status link packets and the
+// recordings. Each byte holds seven bits of the value, lowest first, and the
+// top bit is set on all but the last byte, so a 32-bit value takes one to
+// five bytes.
+
+// Writes the value and returns the end of it
+static inline uint8_t* varint_encode(uint8_t* buffer, uint32_t value) {
+    while (value >= 0x80) {
+        *buffer++ = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    *buffer++ = value;
+    return buffer;
+}
+
+// Reads a value from the buffer that ends at end, and returns the end of it,
+// or NULL if the value is cut off or doesn't fit in 32 bits
+static inline const uint8_t* varint_decode(const uint8_t* buffer, const uint8_t* end, uint32_t* value) {
+    uint32_t result = 0;
+    for (unsigned shift = 0; shift < 32; shift += 7) {
+        if (buffer == end) {
+            return NULL;
+        }
+        uint8_t byte = *buffer++;
+        // The last byte of a 32-bit value only has four bits
+        if (shift == 28 && byte > 0x0F) {
+            return NULL;
+        }
+        result |= (uint32_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return buffer;
+        }
+    }
+    return NULL;
+}
+
+#endif /* VARINT_H_ */
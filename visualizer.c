@@ -29,10 +29,12 @@ SOFTWARE.
 
 #ifdef LCD_ENABLE
 #include "gfx.h"
+#include "lcd_display.h"
 #endif
 
 #ifdef LCD_BACKLIGHT_ENABLE
 #include "lcd_backlight.h"
+#include "interpolation.h"
 #endif
 
 //#define DEBUG_VISUALIZER
@@ -46,6 +48,45 @@ SOFTWARE.
 #ifdef USE_SERIAL_LINK
 #include "serial_link/protocol/transport.h"
 #include "serial_link/system/serial_link.h"
+#ifdef VISUALIZER_COMPACT_STATUS
+#include "status_link.h"
+#endif
+#endif
+
+// With VISUALIZER_CLOCK_SYNC the slaves run the animations on the clock of
+// the master, which it sends in the compact status packets. The animations
+// that are started for a status change start from the time of the change on
+// the master, so the halves of a split keyboard show the same frames.
+#ifdef VISUALIZER_CLOCK_SYNC
+#if !defined(USE_SERIAL_LINK) || !defined(VISUALIZER_COMPACT_STATUS)
+#error "VISUALIZER_CLOCK_SYNC requires USE_SERIAL_LINK and VISUALIZER_COMPACT_STATUS"
+#endif
+#include "clock_sync.h"
+_Static_assert(sizeof(systime_t) == sizeof(uint32_t), "VISUALIZER_CLOCK_SYNC requires a 32-bit system time");
+// The fixed part of the delay of the status packets, in system ticks
+#ifndef VISUALIZER_CLOCK_SYNC_LINK_DELAY
+#define VISUALIZER_CLOCK_SYNC_LINK_DELAY 0
+#endif
+// Older changes start their animations from the time they are seen instead
+#ifndef VISUALIZER_MAX_STATUS_AGE
+#define VISUALIZER_MAX_STATUS_AGE 1000
+#endif
+#endif
+
+#ifdef VISUALIZER_RECORD
+#include "visualizer_record.h"
+// The size of the recording buffer, the recording stops when it's full
+#ifndef VISUALIZER_RECORD_SIZE
+#define VISUALIZER_RECORD_SIZE 4096
+#endif
+#endif
+
+#ifdef VISUALIZER_KEY_EVENTS
+// The queue indices are free running bytes, which wrap around at a multiple
+// of the size
+_Static_assert(VISUALIZER_KEY_EVENT_QUEUE_SIZE > 0 && VISUALIZER_KEY_EVENT_QUEUE_SIZE <= 128 &&
+        (VISUALIZER_KEY_EVENT_QUEUE_SIZE & (VISUALIZER_KEY_EVENT_QUEUE_SIZE - 1)) == 0,
+        "VISUALIZER_KEY_EVENT_QUEUE_SIZE must be a power of two, at most 128");
 #endif
 
 // Define this in config.h
@@ -53,6 +94,38 @@ SOFTWARE.
 #define "Visualizer thread priority not defined"
 #endif
 
+// The stack size can be tuned in config.h, after measuring the real usage
+// with visualizer_get_stack_high_water_mark
+#ifndef VISUALIZER_THREAD_STACK_SIZE
+#define VISUALIZER_THREAD_STACK_SIZE 1024
+#endif
+
+// The time slice and the trace use the same counter as the profile
+#if defined(VISUALIZER_PROFILE) || defined(VISUALIZER_TIME_SLICE) || defined(VISUALIZER_TRACE)
+#ifndef VISUALIZER_PROFILE_COUNTER_FREQUENCY
+#include "hal.h"
+#define VISUALIZER_PROFILE_COUNTER_FREQUENCY halGetCounterFrequency()
+#endif
+#endif
+
+#ifdef VISUALIZER_TRACE
+#ifndef VISUALIZER_TRACE_TIMESTAMP
+#define VISUALIZER_TRACE_TIMESTAMP() chSysGetRealtimeCounterX()
+#endif
+#ifndef VISUALIZER_TRACE_COUNTER_FREQUENCY
+#define VISUALIZER_TRACE_COUNTER_FREQUENCY VISUALIZER_PROFILE_COUNTER_FREQUENCY
+#endif
+#endif
+
+// Called around every frame function, they can be defined in config.h for
+// profiling the keyframes
+#ifndef VISUALIZER_FRAME_BEGIN
+#define VISUALIZER_FRAME_BEGIN(function)
+#endif
+#ifndef VISUALIZER_FRAME_END
+#define VISUALIZER_FRAME_END(function)
+#endif
+
 
 static visualizer_keyboard_status_t current_status = {
     .layer = 0xFFFFFFFF,
@@ -61,93 +134,448 @@ static visualizer_keyboard_status_t current_status = {
     .suspended = false,
 };
 
-static bool same_status(visualizer_keyboard_status_t* status1, visualizer_keyboard_status_t* status2) {
-    return status1->layer == status2->layer &&
-        status1->default_layer == status2->default_layer &&
-        status1->leds == status2->leds &&
-        status1->suspended == status2->suspended;
+// The time when the status changed, on the clock of the master
+static systime_t current_status_time = 0;
+
+// Incremented before and after each write to current_status, so an odd value
+// means that a write is in progress. The status is written only by the
+// keyboard thread, and read by the visualizer thread, which makes a copy and
+// retries if the sequence changed while it was copying.
+static volatile uint32_t status_sequence = 0;
+
+#define COMPILER_BARRIER() __asm__ volatile("" ::: "memory")
+
+#ifdef VISUALIZER_TRACE
+// The status changes are numbered by the status sequence, which is
+// incremented twice for each of them
+#define STATUS_TRACE_ID(sequence) ((uint16_t)((sequence) >> 1))
+// Each thread records into its own ring
+static visualizer_trace_ring_t keyboard_trace;
+static visualizer_trace_ring_t visualizer_thread_trace;
+// The change that the visualizer thread is handling, the animations that the
+// user code starts for it are traced
+static uint16_t trace_change_id;
+static bool trace_change_active = false;
+
+// The stages that are recorded once for each traced animation
+#define TRACE_ANIMATION_STAGES ((1u << VISUALIZER_TRACE_FRAME) | \
+        (1u << VISUALIZER_TRACE_LCD) | (1u << VISUALIZER_TRACE_BACKLIGHT))
+
+static void trace_keyboard(uint8_t stage) {
+    visualizer_trace_record(&keyboard_trace, stage, STATUS_TRACE_ID(status_sequence),
+            VISUALIZER_TRACE_TIMESTAMP());
+}
+
+static void trace_change(uint8_t stage) {
+    visualizer_trace_record(&visualizer_thread_trace, stage, trace_change_id,
+            VISUALIZER_TRACE_TIMESTAMP());
+}
+
+static void trace_animation(keyframe_animation_t* animation, uint8_t stage) {
+    if (animation->trace_stages & (1u << stage)) {
+        animation->trace_stages &= ~(1u << stage);
+        visualizer_trace_record(&visualizer_thread_trace, stage, animation->trace_id,
+                VISUALIZER_TRACE_TIMESTAMP());
+    }
+}
+
+#define TRACE_KEYBOARD(stage) trace_keyboard(stage)
+#define TRACE_CHANGE(stage) trace_change(stage)
+#define TRACE_ANIMATION(animation, stage) trace_animation(animation, stage)
+#else
+#define TRACE_KEYBOARD(stage)
+#define TRACE_CHANGE(stage)
+#define TRACE_ANIMATION(animation, stage)
+#endif
+
+static bool same_status(const visualizer_keyboard_status_t* status1, const visualizer_keyboard_status_t* status2) {
+    return ((status1->layer ^ status2->layer) |
+        (status1->default_layer ^ status2->default_layer) |
+        (status1->leds ^ status2->leds) |
+        (status1->suspended ^ status2->suspended)) == 0;
+}
+
+static uint32_t status_changes(const visualizer_keyboard_status_t* status1, const visualizer_keyboard_status_t* status2) {
+    uint32_t changed = 0;
+    if (status1->layer != status2->layer) {
+        changed |= VISUALIZER_CHANGED_LAYER;
+    }
+    if (status1->default_layer != status2->default_layer) {
+        changed |= VISUALIZER_CHANGED_DEFAULT_LAYER;
+    }
+    if (status1->leds != status2->leds) {
+        changed |= VISUALIZER_CHANGED_LEDS;
+    }
+    if (status1->suspended != status2->suspended) {
+        changed |= VISUALIZER_CHANGED_SUSPENDED;
+    }
+    return changed;
+}
+
+static void publish_status(const visualizer_keyboard_status_t* status, systime_t time) {
+    status_sequence++;
+    COMPILER_BARRIER();
+    current_status = *status;
+    current_status_time = time;
+    COMPILER_BARRIER();
+    status_sequence++;
+    TRACE_KEYBOARD(VISUALIZER_TRACE_STATUS);
+}
+
+// Returns the sequence of the snapshot
+static uint32_t get_status_snapshot(visualizer_keyboard_status_t* status, systime_t* time) {
+    uint32_t sequence;
+    do {
+        sequence = status_sequence;
+        COMPILER_BARRIER();
+        *status = current_status;
+        *time = current_status_time;
+        COMPILER_BARRIER();
+    } while ((sequence & 1) || sequence != status_sequence);
+    return sequence;
 }
 
 static event_source_t layer_changed_event;
 static bool visualizer_enabled = false;
 
-#define MAX_SIMULTANEOUS_ANIMATIONS 4
+#ifdef VISUALIZER_KEY_EVENTS
+// A single producer, single consumer queue. The keyboard thread writes an
+// event and then advances the head, the visualizer thread reads the events
+// and then advances the tail, so neither needs a lock. The overflows are
+// written only by the keyboard thread.
+static visualizer_key_event_t key_events[VISUALIZER_KEY_EVENT_QUEUE_SIZE];
+static volatile uint8_t key_event_head = 0;
+static volatile uint8_t key_event_tail = 0;
+static volatile uint32_t key_event_overflows = 0;
+// The head when the visualizer thread was last woken up for the events,
+// written only by the keyboard thread
+static uint8_t key_event_signaled_head = 0;
+#endif
+
+#ifdef VISUALIZER_RECORD
+// Written only by the keyboard thread
+static uint8_t record_buffer[VISUALIZER_RECORD_SIZE];
+static visualizer_recorder_t recorder;
+#endif
+
+// The running animations are kept in a binary min-heap ordered by the time
+// of their next update, so only the animations that are due are touched
 static keyframe_animation_t* animations[MAX_SIMULTANEOUS_ANIMATIONS] = {};
+static int num_animations = 0;
+// A 32-bit time, which is used for the animation deadlines, it's independent
+// of the resolution of systime_t
+static uint32_t animation_time = 0;
+// Set when a keyframe function returned before it was done, so the thread
+// has to wake up on the next tick
+static bool frame_yielded = false;
+
+#ifdef VISUALIZER_TIME_SLICE
+static rtcnt_t slice_start;
+static rtcnt_t slice_budget;
+#endif
+
+#ifdef VISUALIZER_CLOCK_SYNC
+// The animations started from the status change callbacks start this long
+// before animation_time
+static uint32_t animation_start_delay = 0;
+// Written by the keyboard thread, when a slave receives a status packet
+static clock_sync_t clock_sync;
+
+// The time base of the animations, the clock of the master when this is a
+// slave that has synchronized with it, otherwise the local clock
+static systime_t get_animation_clock(uint8_t* generation) {
+    chSysLock();
+    systime_t time = chVTGetSystemTimeX();
+    if (clock_sync.synchronized) {
+        time = clock_sync_master_time(&clock_sync, time);
+    }
+    *generation = clock_sync.generation;
+    chSysUnlock();
+    return time;
+}
+
+static uint32_t get_status_age(systime_t status_time, systime_t time) {
+    uint32_t age = time - status_time;
+    return age <= MS2ST(VISUALIZER_MAX_STATUS_AGE) ? age : 0;
+}
+#endif
+
+#ifdef LCD_BACKLIGHT_WAVEFORM
+static void stop_backlight_fade(keyframe_animation_t* animation);
+#endif
 
 #ifdef USE_SERIAL_LINK
+#ifdef VISUALIZER_COMPACT_STATUS
+// The full status is sent at this interval even if nothing changes, so that
+// the slaves catch up after a dropped packet
+#ifndef VISUALIZER_STATUS_HEARTBEAT_INTERVAL
+#define VISUALIZER_STATUS_HEARTBEAT_INTERVAL 500
+#endif
+
+typedef struct {
+    uint8_t size;
+#ifdef VISUALIZER_CLOCK_SYNC
+    uint8_t data[STATUS_LINK_MAX_PACKET_SIZE];
+#else
+    uint8_t data[STATUS_LINK_MAX_STATUS_SIZE];
+#endif
+} status_packet_t;
+
+MASTER_TO_ALL_SLAVES_OBJECT(status_packet, status_packet_t);
+
+static remote_object_t* remote_objects[] = {
+    REMOTE_OBJECT(status_packet),
+};
+#else
 MASTER_TO_ALL_SLAVES_OBJECT(current_status, visualizer_keyboard_status_t);
 
 static remote_object_t* remote_objects[] = {
     REMOTE_OBJECT(current_status),
 };
+#endif
 
 #endif
 
 
-void start_keyframe_animation(keyframe_animation_t* animation) {
+static bool deadline_before(keyframe_animation_t* a, keyframe_animation_t* b) {
+    return (int32_t)(a->next_update_time - b->next_update_time) < 0;
+}
+
+static void heap_set(int index, keyframe_animation_t* animation) {
+    animations[index] = animation;
+    animation->scheduler_index = index;
+}
+
+static void heap_sift_up(int index) {
+    keyframe_animation_t* animation = animations[index];
+    while (index > 0) {
+        int parent = (index - 1) / 2;
+        if (!deadline_before(animation, animations[parent])) {
+            break;
+        }
+        heap_set(index, animations[parent]);
+        index = parent;
+    }
+    heap_set(index, animation);
+}
+
+static void heap_sift_down(int index) {
+    keyframe_animation_t* animation = animations[index];
+    while (true) {
+        int child = 2 * index + 1;
+        if (child >= num_animations) {
+            break;
+        }
+        if (child + 1 < num_animations && deadline_before(animations[child + 1], animations[child])) {
+            child++;
+        }
+        if (!deadline_before(animations[child], animation)) {
+            break;
+        }
+        heap_set(index, animations[child]);
+        index = child;
+    }
+    heap_set(index, animation);
+}
+
+static bool heap_push(keyframe_animation_t* animation) {
+    if (num_animations == MAX_SIMULTANEOUS_ANIMATIONS) {
+        return false;
+    }
+    heap_set(num_animations++, animation);
+    heap_sift_up(num_animations - 1);
+    return true;
+}
+
+static void heap_remove(keyframe_animation_t* animation) {
+    int index = animation->scheduler_index;
+    animation->scheduler_index = -1;
+    num_animations--;
+    if (index != num_animations) {
+        heap_set(index, animations[num_animations]);
+        heap_sift_up(index);
+        heap_sift_down(animations[index]->scheduler_index);
+    }
+    animations[num_animations] = NULL;
+}
+
+// The scheduler index of an animation that has never been started is not
+// initialized, so check that it really points back to the animation
+static bool is_scheduled(keyframe_animation_t* animation) {
+    return animation->scheduler_index >= 0 && animation->scheduler_index < num_animations &&
+        animations[animation->scheduler_index] == animation;
+}
+
+bool keyframe_slice_expired(void) {
+#ifdef VISUALIZER_TIME_SLICE
+    return (rtcnt_t)(chSysGetRealtimeCounterX() - slice_start) >= slice_budget;
+#else
+    return false;
+#endif
+}
+
+bool start_keyframe_animation(keyframe_animation_t* animation) {
+#ifdef LCD_BACKLIGHT_WAVEFORM
+    stop_backlight_fade(animation);
+#endif
     animation->current_frame = -1;
     animation->time_left_in_frame = 0;
     animation->need_update = true;
-    int free_index = -1;
-    for (int i=0;i<MAX_SIMULTANEOUS_ANIMATIONS;i++) {
-        if (animations[i] == animation) {
-            return;
-        }
-        if (free_index == -1 && animations[i] == NULL) {
-           free_index=i;
-        }
+    animation->slice = 0;
+#ifdef LCD_BACKLIGHT_ENABLE
+    animation->backlight_fade.frame = -1;
+#endif
+#ifdef VISUALIZER_TRACE
+    animation->trace_stages = 0;
+    if (trace_change_active) {
+        animation->trace_id = trace_change_id;
+        animation->trace_stages = TRACE_ANIMATION_STAGES;
+        TRACE_CHANGE(VISUALIZER_TRACE_ANIMATION_START);
+    }
+#endif
+#ifdef VISUALIZER_CLOCK_SYNC
+    animation->last_update_time = animation_time - animation_start_delay;
+#else
+    animation->last_update_time = animation_time;
+#endif
+    animation->next_update_time = animation_time;
+    if (is_scheduled(animation)) {
+        heap_sift_up(animation->scheduler_index);
+        return true;
     }
-    if (free_index!=-1) {
-        animations[free_index] = animation;
+    if (!heap_push(animation)) {
+        dprint("Too many simultaneous animations\n");
+        animation->current_frame = animation->descriptor->num_frames;
+        animation->scheduler_index = -1;
+        return false;
     }
+    return true;
 }
 
 void stop_keyframe_animation(keyframe_animation_t* animation) {
-    animation->current_frame = animation->num_frames;
+#ifdef LCD_BACKLIGHT_WAVEFORM
+    stop_backlight_fade(animation);
+#endif
+    animation->current_frame = animation->descriptor->num_frames;
     animation->time_left_in_frame = 0;
     animation->need_update = true;
-    for (int i=0;i<MAX_SIMULTANEOUS_ANIMATIONS;i++) {
-        if (animations[i] == animation) {
-            animations[i] = NULL;
-            return;
-        }
+    animation->slice = 0;
+    if (is_scheduled(animation)) {
+        heap_remove(animation);
     }
 }
 
 void stop_all_keyframe_animations(void) {
-    for (int i=0;i<MAX_SIMULTANEOUS_ANIMATIONS;i++) {
-        if (animations[i]) {
-            animations[i]->current_frame = animations[i]->num_frames;
-            animations[i]->time_left_in_frame = 0;
-            animations[i]->need_update = true;
-            animations[i] = NULL;
+#ifdef LCD_BACKLIGHT_WAVEFORM
+    stop_backlight_fade(NULL);
+#endif
+    for (int i=0;i<num_animations;i++) {
+        animations[i]->current_frame = animations[i]->descriptor->num_frames;
+        animations[i]->time_left_in_frame = 0;
+        animations[i]->need_update = true;
+        animations[i]->slice = 0;
+        animations[i]->scheduler_index = -1;
+        animations[i] = NULL;
+    }
+    num_animations = 0;
+}
+
+#ifdef VISUALIZER_PROFILE
+static visualizer_profile_t profile;
+
+static visualizer_frame_profile_t* get_frame_profile(frame_func function) {
+    for (uint32_t i = 0; i < profile.num_functions; i++) {
+        if (profile.functions[i].function == function) {
+            return &profile.functions[i];
         }
     }
+    if (profile.num_functions == VISUALIZER_PROFILE_MAX_FUNCTIONS) {
+        return NULL;
+    }
+    visualizer_frame_profile_t* p = &profile.functions[profile.num_functions];
+    p->function = function;
+    p->min = UINT32_MAX;
+    profile.num_functions++;
+    return p;
+}
+
+static void profile_frame_function(frame_func function, uint32_t ticks) {
+    visualizer_frame_profile_t* p = get_frame_profile(function);
+    if (p == NULL) {
+        profile.untracked_calls++;
+        return;
+    }
+    p->calls++;
+    p->total += ticks;
+    if (ticks < p->min) {
+        p->min = ticks;
+    }
+    if (ticks > p->max) {
+        p->max = ticks;
+    }
+    unsigned bucket = 31 - __builtin_clz(ticks | 1);
+    if (bucket >= VISUALIZER_PROFILE_BUCKETS) {
+        bucket = VISUALIZER_PROFILE_BUCKETS - 1;
+    }
+    if (p->histogram[bucket] != 0xFFFF) {
+        p->histogram[bucket]++;
+    }
+}
+#endif
+
+static bool run_frame_function(keyframe_animation_t* animation, visualizer_state_t* state) {
+    frame_func function = animation->descriptor->keyframes[animation->current_frame].function;
+    TRACE_ANIMATION(animation, VISUALIZER_TRACE_FRAME);
+    VISUALIZER_FRAME_BEGIN(function);
+#ifdef VISUALIZER_PROFILE
+    rtcnt_t start = chSysGetRealtimeCounterX();
+#endif
+    bool ret = (*function)(animation, state);
+#ifdef VISUALIZER_PROFILE
+    profile_frame_function(function, chSysGetRealtimeCounterX() - start);
+    if (animation->slice) {
+        profile.yields++;
+    }
+#endif
+    VISUALIZER_FRAME_END(function);
+    return ret;
 }
 
 static bool update_keyframe_animation(keyframe_animation_t* animation, visualizer_state_t* state, systime_t delta, systime_t* sleep_time) {
     dprintf("Animation frame%d, left %d, delta %d\n", animation->current_frame,
             animation->time_left_in_frame, delta);
-    if (animation->current_frame == animation->num_frames) {
+    const keyframe_animation_descriptor_t* descriptor = animation->descriptor;
+    if (animation->current_frame == descriptor->num_frames) {
         animation->need_update = false;
         return false;
     }
-    if (animation->current_frame == -1) {
+    bool starting = animation->current_frame == -1;
+    if (starting) {
        animation->current_frame = 0;
-       animation->time_left_in_frame = animation->frame_lengths[0];
+       animation->time_left_in_frame = descriptor->keyframes[0].length;
        animation->need_update = true;
-    } else {
+    }
+    bool yielded = false;
+    // An animation that was started in the past catches up, like one that
+    // was updated late
+    if (!starting || delta > 0) {
         animation->time_left_in_frame -= delta;
         while (animation->time_left_in_frame <= 0) {
             int left = animation->time_left_in_frame;
             if (animation->need_update) {
                 animation->time_left_in_frame = 0;
-                (*animation->frame_functions[animation->current_frame])(animation, state);
+                run_frame_function(animation, state);
+                if (animation->slice) {
+                    // The last update of the frame continues on the next tick
+                    animation->time_left_in_frame = left;
+                    yielded = true;
+                    break;
+                }
             }
             animation->current_frame++;
             animation->need_update = true;
-            if (animation->current_frame == animation->num_frames) {
-                if (animation->loop) {
+            if (animation->current_frame == descriptor->num_frames) {
+                if (descriptor->loop) {
                     animation->current_frame = 0;
                 }
                 else {
@@ -156,15 +584,34 @@ static bool update_keyframe_animation(keyframe_animation_t* animation, visualize
                 }
             }
             delta = -left;
-            animation->time_left_in_frame = animation->frame_lengths[animation->current_frame];
+            animation->time_left_in_frame = descriptor->keyframes[animation->current_frame].length;
             animation->time_left_in_frame -= delta;
         }
     }
-    if (animation->need_update) {
-        animation->need_update = (*animation->frame_functions[animation->current_frame])(animation, state);
+    if (animation->need_update && !yielded) {
+        animation->time_to_next_update = 0;
+        animation->need_update = run_frame_function(animation, state);
+        if (animation->slice) {
+            animation->need_update = true;
+            yielded = true;
+        }
+    }
+    if (yielded) {
+        frame_yielded = true;
+        *sleep_time = 1;
+        return true;
     }
 
-    int wanted_sleep = animation->need_update ? 10 : animation->time_left_in_frame;
+    int wanted_sleep = animation->time_left_in_frame;
+    if (animation->need_update) {
+        int interval = descriptor->frame_interval ? descriptor->frame_interval : DEFAULT_KEYFRAME_INTERVAL;
+        if (animation->time_to_next_update > interval) {
+            interval = animation->time_to_next_update;
+        }
+        if (interval < wanted_sleep) {
+            wanted_sleep = interval;
+        }
+    }
     if ((unsigned)wanted_sleep < *sleep_time) {
         *sleep_time = wanted_sleep;
     }
@@ -172,6 +619,33 @@ static bool update_keyframe_animation(keyframe_animation_t* animation, visualize
     return true;
 }
 
+// Updates the animations that are due, and returns the time until the next
+// animation needs to be updated
+static systime_t update_animations(visualizer_state_t* state) {
+    while (num_animations > 0 &&
+            (int32_t)(animations[0]->next_update_time - animation_time) <= 0) {
+        keyframe_animation_t* animation = animations[0];
+        heap_remove(animation);
+        uint32_t delta = animation_time - animation->last_update_time;
+        animation->last_update_time = animation_time;
+        systime_t sleep_time = TIME_INFINITE;
+        // The animation might have been started again by a keyframe function,
+        // in that case it's already scheduled
+        if (update_keyframe_animation(animation, state, delta, &sleep_time) &&
+                !is_scheduled(animation)) {
+            animation->next_update_time = animation_time + sleep_time;
+            if (!heap_push(animation)) {
+                dprint("Too many simultaneous animations\n");
+                animation->current_frame = animation->descriptor->num_frames;
+            }
+        }
+    }
+    if (num_animations == 0) {
+        return TIME_INFINITE;
+    }
+    return animations[0]->next_update_time - animation_time;
+}
+
 bool keyframe_no_operation(keyframe_animation_t* animation, visualizer_state_t* state) {
     (void)animation;
     (void)state;
@@ -179,39 +653,177 @@ bool keyframe_no_operation(keyframe_animation_t* animation, visualizer_state_t*
 }
 
 #ifdef LCD_BACKLIGHT_ENABLE
-bool keyframe_animate_backlight_color(keyframe_animation_t* animation, visualizer_state_t* state) {
-    int frame_length = animation->frame_lengths[animation->current_frame];
-    int current_pos = frame_length - animation->time_left_in_frame;
+#ifdef LCD_BACKLIGHT_WAVEFORM
+// The fade that the HAL plays back the rest of the frame of, which started at
+// start_pos of the frame and animation_time start_time. There's only one
+// backlight, so only the animation that wrote it last can be playing.
+typedef struct {
+    keyframe_animation_t* animation;
+    uint32_t start_pos;
+    uint32_t end_pos;
+    uint32_t start_time;
+    uint32_t period;
+} backlight_playback_t;
+
+static backlight_playback_t backlight_playback;
+#endif
+
+static void init_backlight_fade(keyframe_animation_t* animation, visualizer_state_t* state, easing_t easing) {
+    keyframe_backlight_fade_t* fade = &animation->backlight_fade;
+    int frame_length = animation->descriptor->keyframes[animation->current_frame].length;
+    if (fade->frame == animation->current_frame &&
+            fade->from == state->prev_lcd_color && fade->to == state->target_lcd_color &&
+            fade->interpolation.easing == easing && fade->interpolation.length == (uint32_t)frame_length) {
+        return;
+    }
+    fade->frame = animation->current_frame;
+#ifdef LCD_BACKLIGHT_WAVEFORM
+    if (backlight_playback.animation == animation) {
+        backlight_playback.animation = NULL;
+    }
+#endif
+    fade->from = state->prev_lcd_color;
+    fade->to = state->target_lcd_color;
+    interpolation_init(&fade->interpolation, easing, frame_length);
+
     uint8_t t_h = LCD_HUE(state->target_lcd_color);
-    uint8_t t_s = LCD_SAT(state->target_lcd_color);
-    uint8_t t_i = LCD_INT(state->target_lcd_color);
     uint8_t p_h = LCD_HUE(state->prev_lcd_color);
-    uint8_t p_s = LCD_SAT(state->prev_lcd_color);
-    uint8_t p_i = LCD_INT(state->prev_lcd_color);
-
     uint8_t d_h1 = t_h - p_h; //Modulo arithmetic since we want to wrap around
     int d_h2 = t_h - p_h;
-    // Chose the shortest way around
+    // Chose the shortest way around, the result is wrapped when the color is
+    // put together
     int d_h = abs(d_h2) < d_h1 ? d_h2 : d_h1;
-    int d_s = t_s - p_s;
-    int d_i = t_i - p_i;
-
-    int hue = (d_h * current_pos) / frame_length;
-    int sat = (d_s * current_pos) / frame_length;
-    int intensity = (d_i * current_pos) / frame_length;
-    //dprintf("%X -> %X = %X\n", p_h, t_h, hue);
-    hue += p_h;
-    sat += p_s;
-    intensity += p_i;
-    state->current_lcd_color = LCD_COLOR(hue, sat, intensity);
-    lcd_backlight_color(
-            LCD_HUE(state->current_lcd_color),
-            LCD_SAT(state->current_lcd_color),
-            LCD_INT(state->current_lcd_color));
+    interpolated_value_init(&fade->hue, p_h, p_h + d_h);
+    interpolated_value_init(&fade->saturation, LCD_SAT(state->prev_lcd_color), LCD_SAT(state->target_lcd_color));
+    interpolated_value_init(&fade->intensity, LCD_INT(state->prev_lcd_color), LCD_INT(state->target_lcd_color));
+}
+
+static uint32_t backlight_fade_color(keyframe_backlight_fade_t* fade, uint32_t pos) {
+    uint32_t progress = interpolation_progress(&fade->interpolation, pos);
+    uint8_t hue = interpolated_value_get(&fade->hue, progress);
+    uint8_t sat = interpolated_value_get(&fade->saturation, progress);
+    uint8_t intensity = interpolated_value_get(&fade->intensity, progress);
+    return LCD_COLOR(hue, sat, intensity);
+}
+
+#ifdef LCD_BACKLIGHT_WAVEFORM
+// The number of samples precomputed for the HAL, longer fades are played
+// back with a longer period
+#ifndef LCD_BACKLIGHT_WAVEFORM_SIZE
+#define LCD_BACKLIGHT_WAVEFORM_SIZE 64
+#endif
+
+static lcd_backlight_rgb_t backlight_waveform[LCD_BACKLIGHT_WAVEFORM_SIZE];
 
+// Precomputes the rest of the frame and lets the HAL play it back, so that
+// the visualizer thread can sleep until the frame ends
+static void play_backlight_fade(keyframe_animation_t* animation, uint32_t pos) {
+    keyframe_backlight_fade_t* fade = &animation->backlight_fade;
+    uint32_t length = fade->interpolation.length;
+    uint32_t period_ms = (ST2MS(length - pos) + LCD_BACKLIGHT_WAVEFORM_SIZE - 1) / LCD_BACKLIGHT_WAVEFORM_SIZE;
+    if (period_ms == 0) {
+        period_ms = 1;
+    }
+    uint32_t period = MS2ST(period_ms);
+    uint16_t count = 0;
+    uint32_t sample_pos = pos;
+    while (count < LCD_BACKLIGHT_WAVEFORM_SIZE && sample_pos + period < length) {
+        sample_pos += period;
+        uint32_t color = backlight_fade_color(fade, sample_pos);
+        lcd_backlight_color_to_rgb(LCD_HUE(color), LCD_SAT(color), LCD_INT(color), &backlight_waveform[count++]);
+    }
+    if (count > 0) {
+        lcd_backlight_hal_play(backlight_waveform, count, period_ms);
+    }
+    backlight_playback_t* playback = &backlight_playback;
+    playback->animation = animation;
+    playback->start_pos = pos;
+    playback->end_pos = sample_pos;
+    playback->start_time = animation_time;
+    playback->period = period;
+}
+
+// The color that the HAL is currently showing, only valid while a fade is
+// playing
+static uint32_t backlight_fade_played_color(void) {
+    backlight_playback_t* playback = &backlight_playback;
+    uint32_t elapsed = animation_time - playback->start_time;
+    uint32_t pos = playback->start_pos + elapsed - elapsed % playback->period;
+    if (pos > playback->end_pos) {
+        pos = playback->end_pos;
+    }
+    return backlight_fade_color(&playback->animation->backlight_fade, pos);
+}
+
+// Keeps the color that is shown when the animation playing the fade is
+// restarted or stopped, NULL matches all animations
+static void stop_backlight_fade(keyframe_animation_t* animation) {
+    backlight_playback_t* playback = &backlight_playback;
+    if (playback->animation != NULL && (animation == NULL || animation == playback->animation)) {
+        uint32_t color = backlight_fade_played_color();
+        lcd_backlight_color(LCD_HUE(color), LCD_SAT(color), LCD_INT(color));
+        playback->animation = NULL;
+    }
+}
+#endif
+
+static bool animate_backlight_color(keyframe_animation_t* animation, visualizer_state_t* state, easing_t easing) {
+    init_backlight_fade(animation, state, easing);
+    keyframe_backlight_fade_t* fade = &animation->backlight_fade;
+    int frame_length = animation->descriptor->keyframes[animation->current_frame].length;
+    uint32_t current_pos = frame_length - animation->time_left_in_frame;
+#ifdef LCD_BACKLIGHT_WAVEFORM
+    if (backlight_playback.animation == animation && current_pos < (uint32_t)frame_length) {
+        animation->time_to_next_update = frame_length - current_pos;
+        return true;
+    }
+    // The color written below stops the playback, whichever animation
+    // started it
+    backlight_playback.animation = NULL;
+#endif
+    uint32_t color = backlight_fade_color(fade, current_pos);
+    state->current_lcd_color = color;
+    // This also stops any earlier playback
+    lcd_backlight_color(LCD_HUE(color), LCD_SAT(color), LCD_INT(color));
+    TRACE_ANIMATION(animation, VISUALIZER_TRACE_BACKLIGHT);
+#ifdef LCD_BACKLIGHT_WAVEFORM
+    if (current_pos < (uint32_t)frame_length) {
+        play_backlight_fade(animation, current_pos);
+        animation->time_to_next_update = frame_length - current_pos;
+        return true;
+    }
+#endif
+
+    // There's no need to update again until one of the components change
+    uint32_t next_pos = interpolated_value_next_change(&fade->hue, &fade->interpolation, current_pos);
+    uint32_t next_pos_s = interpolated_value_next_change(&fade->saturation, &fade->interpolation, current_pos);
+    uint32_t next_pos_i = interpolated_value_next_change(&fade->intensity, &fade->interpolation, current_pos);
+    next_pos = next_pos_s < next_pos ? next_pos_s : next_pos;
+    next_pos = next_pos_i < next_pos ? next_pos_i : next_pos;
+    animation->time_to_next_update = next_pos - current_pos;
     return true;
 }
 
+bool keyframe_animate_backlight_color(keyframe_animation_t* animation, visualizer_state_t* state) {
+    return animate_backlight_color(animation, state, EASING_LINEAR);
+}
+
+bool keyframe_animate_backlight_color_ease_in(keyframe_animation_t* animation, visualizer_state_t* state) {
+    return animate_backlight_color(animation, state, EASING_IN);
+}
+
+bool keyframe_animate_backlight_color_ease_out(keyframe_animation_t* animation, visualizer_state_t* state) {
+    return animate_backlight_color(animation, state, EASING_OUT);
+}
+
+bool keyframe_animate_backlight_color_ease_in_out(keyframe_animation_t* animation, visualizer_state_t* state) {
+    return animate_backlight_color(animation, state, EASING_IN_OUT);
+}
+
+bool keyframe_animate_backlight_color_smoothstep(keyframe_animation_t* animation, visualizer_state_t* state) {
+    return animate_backlight_color(animation, state, EASING_SMOOTHSTEP);
+}
+
 bool keyframe_set_backlight_color(keyframe_animation_t* animation, visualizer_state_t* state) {
     (void)animation;
     state->prev_lcd_color = state->target_lcd_color;
@@ -220,19 +832,33 @@ bool keyframe_set_backlight_color(keyframe_animation_t* animation, visualizer_st
             LCD_HUE(state->current_lcd_color),
             LCD_SAT(state->current_lcd_color),
             LCD_INT(state->current_lcd_color));
+    TRACE_ANIMATION(animation, VISUALIZER_TRACE_BACKLIGHT);
     return false;
 }
 #endif // LCD_BACKLIGHT_ENABLE
 
 #ifdef LCD_ENABLE
-bool keyframe_display_layer_text(keyframe_animation_t* animation, visualizer_state_t* state) {
-    (void)animation;
-    gdispClear(White);
-    gdispDrawString(0, 10, state->layer_text, state->font_dejavusansbold12, Black);
-    gdispFlush();
+// Draws the frame one text line at a time, until the time slice expires
+static bool end_lcd_frame(keyframe_animation_t* animation) {
+    animation->slice = 1;
+    while (!lcd_display_end_frame_step()) {
+        if (keyframe_slice_expired()) {
+            return false;
+        }
+    }
+    animation->slice = 0;
+    TRACE_ANIMATION(animation, VISUALIZER_TRACE_LCD);
     return false;
 }
 
+bool keyframe_display_layer_text(keyframe_animation_t* animation, visualizer_state_t* state) {
+    if (animation->slice == 0) {
+        lcd_display_begin_frame();
+        lcd_display_draw_string(0, 10, state->layer_text, state->font_dejavusansbold12);
+    }
+    return end_lcd_frame(animation);
+}
+
 static void format_layer_bitmap_string(uint16_t default_layer, uint16_t layer, char* buffer) {
     for (int i=0; i<16;i++)
     {
@@ -259,17 +885,17 @@ static void format_layer_bitmap_string(uint16_t default_layer, uint16_t layer, c
 }
 
 bool keyframe_display_layer_bitmap(keyframe_animation_t* animation, visualizer_state_t* state) {
-    (void)animation;
-    const char* layer_help = "1=On D=Default B=Both";
-    char layer_buffer[16 + 4]; // 3 spaces and one null terminator
-    gdispClear(White);
-    gdispDrawString(0, 0, layer_help, state->font_fixed5x8, Black);
-    format_layer_bitmap_string(state->status.default_layer, state->status.layer, layer_buffer);
-    gdispDrawString(0, 10, layer_buffer, state->font_fixed5x8, Black);
-    format_layer_bitmap_string(state->status.default_layer >> 16, state->status.layer >> 16, layer_buffer);
-    gdispDrawString(0, 20, layer_buffer, state->font_fixed5x8, Black);
-    gdispFlush();
-    return false;
+    if (animation->slice == 0) {
+        const char* layer_help = "1=On D=Default B=Both";
+        char layer_buffer[16 + 4]; // 3 spaces and one null terminator
+        lcd_display_begin_frame();
+        lcd_display_draw_string(0, 0, layer_help, state->font_fixed5x8);
+        format_layer_bitmap_string(state->status.default_layer, state->status.layer, layer_buffer);
+        lcd_display_draw_string(0, 10, layer_buffer, state->font_fixed5x8);
+        format_layer_bitmap_string(state->status.default_layer >> 16, state->status.layer >> 16, layer_buffer);
+        lcd_display_draw_string(0, 20, layer_buffer, state->font_fixed5x8);
+    }
+    return end_lcd_frame(animation);
 }
 #endif // LCD_ENABLE
 
@@ -277,10 +903,13 @@ bool keyframe_disable_lcd_and_backlight(keyframe_animation_t* animation, visuali
     (void)animation;
     (void)state;
 #ifdef LCD_ENABLE
+    lcd_display_wait_flush();
     gdispSetPowerMode(powerOff);
+    TRACE_ANIMATION(animation, VISUALIZER_TRACE_LCD);
 #endif
 #ifdef LCD_BACKLIGHT_ENABLE
     lcd_backlight_hal_color(0, 0, 0);
+    TRACE_ANIMATION(animation, VISUALIZER_TRACE_BACKLIGHT);
 #endif
     return false;
 }
@@ -290,10 +919,61 @@ bool keyframe_enable_lcd_and_backlight(keyframe_animation_t* animation, visualiz
     (void)state;
 #ifdef LCD_ENABLE
     gdispSetPowerMode(powerOn);
+    TRACE_ANIMATION(animation, VISUALIZER_TRACE_LCD);
+    // The display might have lost its contents while powered off
+    lcd_display_invalidate();
 #endif
     return false;
 }
 
+// The user code overrides one of these
+__attribute__((weak))
+void update_user_visualizer_state(visualizer_state_t* state) {
+    (void)state;
+}
+
+__attribute__((weak))
+void update_user_visualizer_state_changes(visualizer_state_t* state, const visualizer_status_change_t* change) {
+    (void)change;
+    update_user_visualizer_state(state);
+    state->prev_lcd_color = state->current_lcd_color;
+}
+
+#ifdef VISUALIZER_KEY_EVENTS
+__attribute__((weak))
+void user_visualizer_key_events(visualizer_state_t* state, const visualizer_key_event_t* events, uint8_t count) {
+    (void)state;
+    (void)events;
+    (void)count;
+}
+
+// Passes the queued key events to the user code, or drops them when the
+// visualizer is disabled
+static void dispatch_key_events(visualizer_state_t* state) {
+    uint8_t head = key_event_head;
+    COMPILER_BARRIER();
+    uint8_t tail = key_event_tail;
+    while (tail != head) {
+        uint8_t index = tail % VISUALIZER_KEY_EVENT_QUEUE_SIZE;
+        uint8_t count = (uint8_t)(head - tail);
+        if (count > VISUALIZER_KEY_EVENT_QUEUE_SIZE - index) {
+            count = VISUALIZER_KEY_EVENT_QUEUE_SIZE - index;
+        }
+        if (visualizer_enabled) {
+            user_visualizer_key_events(state, &key_events[index], count);
+#ifdef VISUALIZER_PROFILE
+            profile.key_events += count;
+            profile.key_event_batches++;
+#endif
+        }
+        tail += count;
+    }
+    // The slots are only reused after the user code is done with them
+    COMPILER_BARRIER();
+    key_event_tail = tail;
+}
+#endif
+
 bool enable_visualization(keyframe_animation_t* animation, visualizer_state_t* state) {
     (void)animation;
     (void)state;
@@ -302,11 +982,18 @@ bool enable_visualization(keyframe_animation_t* animation, visualizer_state_t* s
     return false;
 }
 
-// TODO: Optimize the stack size, this is probably way too big
-static THD_WORKING_AREA(visualizerThreadStack, 1024);
+static THD_WORKING_AREA(visualizerThreadStack, VISUALIZER_THREAD_STACK_SIZE);
 static THD_FUNCTION(visualizerThread, arg) {
     (void)arg;
 
+#ifdef LCD_ENABLE
+    gfxInit();
+#endif
+
+#ifdef LCD_BACKLIGHT_ENABLE
+    lcd_backlight_init();
+#endif
+
     event_listener_t event_listener;
     chEvtRegister(&layer_changed_event, &event_listener, 0);
 
@@ -336,43 +1023,135 @@ static THD_FUNCTION(visualizerThread, arg) {
 #endif
 
     systime_t sleep_time = TIME_INFINITE;
+#ifdef VISUALIZER_CLOCK_SYNC
+    uint8_t clock_generation;
+    systime_t current_time = get_animation_clock(&clock_generation);
+#else
     systime_t current_time = chVTGetSystemTimeX();
+#endif
+#ifdef VISUALIZER_TRACE
+    uint32_t traced_sequence = 0;
+#endif
 
     while(true) {
-        systime_t new_time = chVTGetSystemTimeX();
+#ifdef VISUALIZER_PROFILE
+        rtcnt_t wakeup_time = chSysGetRealtimeCounterX();
+        profile.wakeups++;
+#endif
+#ifdef VISUALIZER_TIME_SLICE
+        slice_start = chSysGetRealtimeCounterX();
+#endif
+#ifdef VISUALIZER_TRACE
+        uint32_t trace_wakeup_time = VISUALIZER_TRACE_TIMESTAMP();
+#endif
+        frame_yielded = false;
+        // The time the update takes is measured on the local clock, which
+        // the sleep is too
+        systime_t update_start = chVTGetSystemTimeX();
+#ifdef VISUALIZER_CLOCK_SYNC
+        uint8_t generation;
+        systime_t new_time = get_animation_clock(&generation);
+        if (generation != clock_generation) {
+            // The clock jumped when it was synchronized, the animations
+            // continue from where they were
+            clock_generation = generation;
+            current_time = new_time;
+        }
+        // The estimate can also move back a little, but the animations never
+        // do
+        if ((int32_t)(new_time - current_time) < 0) {
+            new_time = current_time;
+        }
+#else
+        systime_t new_time = update_start;
+#endif
         systime_t delta = new_time - current_time;
         current_time = new_time;
+        animation_time += delta;
+#ifdef LCD_BACKLIGHT_WAVEFORM
+        // The user code sees the color that is currently played back
+        if (backlight_playback.animation != NULL) {
+            state.current_lcd_color = backlight_fade_played_color();
+        }
+#endif
         bool enabled = visualizer_enabled;
-        if (!same_status(&state.status, &current_status)) {
+        visualizer_keyboard_status_t new_status;
+        systime_t new_status_time;
+        uint32_t new_status_sequence = get_status_snapshot(&new_status, &new_status_time);
+        if (!same_status(&state.status, &new_status)) {
+#ifdef VISUALIZER_TRACE
+            trace_change_id = STATUS_TRACE_ID(new_status_sequence);
+            trace_change_active = true;
+            // A change is handled again while the visualizer is disabled
+            if (new_status_sequence != traced_sequence) {
+                traced_sequence = new_status_sequence;
+                visualizer_trace_record(&visualizer_thread_trace, VISUALIZER_TRACE_WAKEUP,
+                        trace_change_id, trace_wakeup_time);
+            }
+#else
+            (void)new_status_sequence;
+#endif
+#ifdef VISUALIZER_CLOCK_SYNC
+            animation_start_delay = get_status_age(new_status_time, new_time);
+#else
+            (void)new_status_time;
+#endif
             if (visualizer_enabled) {
-                if (current_status.suspended) {
+                if (new_status.suspended) {
                     stop_all_keyframe_animations();
                     visualizer_enabled = false;
-                    state.status = current_status;
+                    state.status = new_status;
+                    TRACE_CHANGE(VISUALIZER_TRACE_USER_STATE);
                     user_visualizer_suspend(&state);
+                    state.prev_lcd_color = state.current_lcd_color;
                 }
                 else {
-                    state.status = current_status;
-                    update_user_visualizer_state(&state);
+                    visualizer_status_change_t change = {
+                        .changed = status_changes(&state.status, &new_status),
+                        .previous = state.status,
+                    };
+                    state.status = new_status;
+                    TRACE_CHANGE(VISUALIZER_TRACE_USER_STATE);
+                    update_user_visualizer_state_changes(&state, &change);
                 }
-                state.prev_lcd_color = state.current_lcd_color;
             }
+#ifdef VISUALIZER_CLOCK_SYNC
+            animation_start_delay = 0;
+#endif
         }
-        if (!enabled && state.status.suspended && current_status.suspended == false) {
+        if (!enabled && state.status.suspended && new_status.suspended == false) {
             // Setting the status to the initial status will force an update
             // when the visualizer is enabled again
             state.status = initial_status;
             state.status.suspended = false;
             stop_all_keyframe_animations();
+            TRACE_CHANGE(VISUALIZER_TRACE_USER_STATE);
             user_visualizer_resume(&state);
             state.prev_lcd_color = state.current_lcd_color;
         }
-        sleep_time = TIME_INFINITE;
-        for (int i=0;i<MAX_SIMULTANEOUS_ANIMATIONS;i++) {
-            if (animations[i]) {
-                update_keyframe_animation(animations[i], &state, delta, &sleep_time);
-            }
+#ifdef VISUALIZER_TRACE
+        trace_change_active = false;
+#endif
+#ifdef VISUALIZER_KEY_EVENTS
+        // After the status, so that the user code sees the layers that the
+        // keys were pressed on, and before the animations, so that the ones
+        // it starts are updated right away
+        dispatch_key_events(&state);
+#endif
+        sleep_time = update_animations(&state);
+#ifdef LCD_ENABLE
+        // A frame that was drawn while the previous one was still being sent
+        // is flushed when that completes
+        if (lcd_display_flush_pending()) {
+            lcd_display_flush();
         }
+#endif
+#ifdef VISUALIZER_PROFILE
+        if (!profile.first_frame_done) {
+            profile.first_frame_time = chVTGetSystemTimeX() - profile.start_time;
+            profile.first_frame_done = true;
+        }
+#endif
         // The animation can enable the visualizer
         // And we might need to update the state when that happens
         // so don't sleep
@@ -380,8 +1159,7 @@ static THD_FUNCTION(visualizerThread, arg) {
             sleep_time = 0;
         }
 
-        systime_t after_update = chVTGetSystemTimeX();
-        unsigned update_delta = after_update - current_time;
+        unsigned update_delta = chVTGetSystemTimeX() - update_start;
         if (sleep_time != TIME_INFINITE) {
             if (sleep_time > update_delta) {
                 sleep_time -= update_delta;
@@ -390,8 +1168,23 @@ static THD_FUNCTION(visualizerThread, arg) {
                 sleep_time = 0;
             }
         }
+        // Let the other threads run before continuing the unfinished frame
+        if (frame_yielded && sleep_time == 0) {
+            sleep_time = 1;
+        }
         dprintf("Update took %d, last delta %d, sleep_time %d\n", update_delta, delta, sleep_time);
+#ifdef VISUALIZER_PROFILE
+        rtcnt_t busy = chSysGetRealtimeCounterX() - wakeup_time;
+        profile.busy += busy;
+        if (busy > profile.max_busy) {
+            profile.max_busy = busy;
+        }
+#endif
+#ifdef LCD_ENABLE
+        chEvtWaitOneTimeout(EVENT_MASK(0) | LCD_DISPLAY_FLUSH_EVENTS, sleep_time);
+#else
         chEvtWaitOneTimeout(EVENT_MASK(0), sleep_time);
+#endif
     }
 #ifdef LCD_ENABLE
     gdispCloseFont(state.font_fixed5x8);
@@ -400,29 +1193,188 @@ static THD_FUNCTION(visualizerThread, arg) {
 }
 
 void visualizer_init(void) {
-#ifdef LCD_ENABLE
-    gfxInit();
-#endif
-
-#ifdef LCD_BACKLIGHT_ENABLE
-    lcd_backlight_init();
-#endif
-
+    // The display and the backlight are initialized by the visualizer thread,
+    // so that the first matrix scan doesn't have to wait for them. The status
+    // updates made before that are coalesced into the latest status, which
+    // the thread reads when it starts.
 #ifdef USE_SERIAL_LINK
     add_remote_objects(remote_objects, sizeof(remote_objects) / sizeof(remote_object_t*) );
 #endif
     // We are using a low priority thread, the idea is to have it run only
     // when the main thread is sleeping during the matrix scanning
     chEvtObjectInit(&layer_changed_event);
+#ifdef VISUALIZER_CLOCK_SYNC
+    clock_sync_init(&clock_sync, VISUALIZER_CLOCK_SYNC_LINK_DELAY);
+#endif
+#ifdef VISUALIZER_RECORD
+    visualizer_recorder_init(&recorder, record_buffer, sizeof(record_buffer), chVTGetSystemTimeX(),
+            CH_CFG_ST_FREQUENCY);
+#endif
+#ifdef VISUALIZER_PROFILE
+    profile.counter_frequency = VISUALIZER_PROFILE_COUNTER_FREQUENCY;
+    profile.start_time = chVTGetSystemTimeX();
+#endif
+#ifdef VISUALIZER_TIME_SLICE
+    slice_budget = (uint64_t)VISUALIZER_TIME_SLICE * VISUALIZER_PROFILE_COUNTER_FREQUENCY / 1000000;
+#endif
+    memset(visualizerThreadStack, VISUALIZER_STACK_FILL_VALUE, sizeof(visualizerThreadStack));
     (void)chThdCreateStatic(visualizerThreadStack, sizeof(visualizerThreadStack),
                               VISUALIZER_THREAD_PRIORITY, visualizerThread, NULL);
 }
 
+#ifdef VISUALIZER_PROFILE
+const visualizer_profile_t* visualizer_get_profile(void) {
+    return &profile;
+}
+
+static inline uint32_t ticks_to_us(uint64_t ticks) {
+    return ticks * 1000000 / profile.counter_frequency;
+}
+
+void visualizer_print_profile(void) {
+    dprintf("Visualizer wakeups %lu in %lu ms, busy %lu ms\n", (unsigned long)profile.wakeups,
+            (unsigned long)ST2MS(chVTGetSystemTimeX() - profile.start_time),
+            (unsigned long)(ticks_to_us(profile.busy) / 1000));
+    dprintf("Longest run %lu us, %lu yields\n", (unsigned long)ticks_to_us(profile.max_busy),
+            (unsigned long)profile.yields);
+    dprintf("First scan after %lu ms, first frame after %lu ms\n",
+            (unsigned long)ST2MS(profile.first_scan_time),
+            (unsigned long)ST2MS(profile.first_frame_time));
+    for (uint32_t i = 0; i < profile.num_functions; i++) {
+        const visualizer_frame_profile_t* p = &profile.functions[i];
+        dprintf("Frame %p calls %lu min %lu us max %lu us mean %lu us\n", (void*)p->function,
+                (unsigned long)p->calls, (unsigned long)ticks_to_us(p->min),
+                (unsigned long)ticks_to_us(p->max), (unsigned long)ticks_to_us(p->total / p->calls));
+        for (int bucket = 0; bucket < VISUALIZER_PROFILE_BUCKETS; bucket++) {
+            if (p->histogram[bucket]) {
+                dprintf("  from %lu ticks: %u\n", 1ul << bucket, p->histogram[bucket]);
+            }
+        }
+    }
+    if (profile.untracked_calls) {
+        dprintf("Untracked calls %lu\n", (unsigned long)profile.untracked_calls);
+    }
+}
+#endif
+
+#ifdef VISUALIZER_TRACE
+void visualizer_get_trace(visualizer_trace_t* trace) {
+    trace->counter_frequency = VISUALIZER_TRACE_COUNTER_FREQUENCY;
+    trace->num_events = 0;
+    // The keyboard thread events go first when the times are the same
+    visualizer_trace_merge(trace, &keyboard_trace);
+    visualizer_trace_merge(trace, &visualizer_thread_trace);
+}
+
+static inline uint32_t trace_ticks_to_us(uint32_t ticks, uint32_t frequency) {
+    return (uint64_t)ticks * 1000000 / frequency;
+}
+
+void visualizer_print_trace(void) {
+    // Too big for the stack of the caller
+    static visualizer_trace_t trace;
+    visualizer_trace_latency_t latencies[VISUALIZER_TRACE_NUM_STAGES];
+    visualizer_get_trace(&trace);
+    visualizer_trace_analyze(&trace, latencies);
+    dprintf("Latency from the status change in us, %lu changes\n",
+            (unsigned long)latencies[VISUALIZER_TRACE_STATUS].count);
+    for (uint8_t stage = VISUALIZER_TRACE_STATUS + 1; stage < VISUALIZER_TRACE_NUM_STAGES; stage++) {
+        const visualizer_trace_latency_t* l = &latencies[stage];
+        if (l->count == 0) {
+            continue;
+        }
+        dprintf("%s: %lu changes p50 %lu p90 %lu p99 %lu max %lu\n", visualizer_trace_stage_name(stage),
+                (unsigned long)l->count,
+                (unsigned long)trace_ticks_to_us(l->p50, trace.counter_frequency),
+                (unsigned long)trace_ticks_to_us(l->p90, trace.counter_frequency),
+                (unsigned long)trace_ticks_to_us(l->p99, trace.counter_frequency),
+                (unsigned long)trace_ticks_to_us(l->max, trace.counter_frequency));
+    }
+}
+#endif
+
+#ifdef VISUALIZER_RECORD
+const uint8_t* visualizer_get_recording(size_t* size) {
+    visualizer_recorder_flush(&recorder);
+    *size = recorder.used;
+    return record_buffer;
+}
+#endif
+
+#ifdef VISUALIZER_CLOCK_SYNC
+void visualizer_get_clock_sync(clock_sync_t* sync) {
+    chSysLock();
+    *sync = clock_sync;
+    chSysUnlock();
+}
+#endif
+
+// Depending on the ChibiOS version the thread structure is either at the
+// start or the end of the working area, and the stack grows down towards the
+// start. So the untouched bytes are counted from the start, and the size of
+// the thread structure is always left out.
+size_t visualizer_get_stack_size(void) {
+    return sizeof(visualizerThreadStack) - sizeof(thread_t);
+}
+
+size_t visualizer_get_stack_high_water_mark(void) {
+    const uint8_t* stack = (const uint8_t*)visualizerThreadStack + sizeof(thread_t);
+    size_t size = visualizer_get_stack_size();
+    size_t unused = 0;
+    while (unused < size && stack[unused] == VISUALIZER_STACK_FILL_VALUE) {
+        unused++;
+    }
+    return size - unused;
+}
+
 void update_status(bool changed) {
     if (changed) {
+        TRACE_KEYBOARD(VISUALIZER_TRACE_BROADCAST);
         chEvtBroadcast(&layer_changed_event);
     }
-#ifdef USE_SERIAL_LINK
+#if defined(USE_SERIAL_LINK) && defined(VISUALIZER_COMPACT_STATUS)
+    // The packets contain all the fields that changed since the last
+    // heartbeat, rather than since the previous packet. So a slave that
+    // misses a packet, or only reads the latest of several, is still up to
+    // date after the next one.
+    static bool heartbeat_sent = false;
+    static systime_t last_heartbeat = 0;
+    static uint32_t changed_fields = 0;
+    static visualizer_keyboard_status_t sent_status;
+    systime_t current_update = chVTGetSystemTimeX();
+#ifdef VISUALIZER_CLOCK_SYNC
+    static systime_t last_change = 0;
+    if (changed) {
+        last_change = current_update;
+    }
+#endif
+    bool heartbeat = !heartbeat_sent ||
+        current_update - last_heartbeat > MS2ST(VISUALIZER_STATUS_HEARTBEAT_INTERVAL);
+    if (changed || heartbeat) {
+        changed_fields |= status_changes(&sent_status, &current_status);
+        if (heartbeat) {
+            heartbeat_sent = true;
+            last_heartbeat = current_update;
+        }
+        uint32_t fields = heartbeat ? STATUS_LINK_ALL_FIELDS : changed_fields;
+        status_link_time_t time = {
+            .time = current_update,
+        };
+#ifdef VISUALIZER_CLOCK_SYNC
+        // Every packet has the time for synchronizing the clocks, and the
+        // time of the change, for a slave that missed the packet with it
+        fields |= STATUS_LINK_TIME;
+        time.age = current_update - last_change;
+#endif
+        status_packet_t* packet = begin_write_status_packet();
+        packet->size = status_link_encode(fields, &current_status, &time, packet->data);
+        end_write_status_packet();
+        sent_status = current_status;
+        if (heartbeat) {
+            changed_fields = 0;
+        }
+    }
+#elif defined(USE_SERIAL_LINK)
     static systime_t last_update = 0;
     systime_t current_update = chVTGetSystemTimeX();
     systime_t delta = current_update - last_update;
@@ -435,20 +1387,58 @@ void update_status(bool changed) {
 #endif
 }
 
+// The time of the status changes made on this half
+static systime_t get_local_status_time(void) {
+#ifdef VISUALIZER_CLOCK_SYNC
+    uint8_t generation;
+    return get_animation_clock(&generation);
+#else
+    return chVTGetSystemTimeX();
+#endif
+}
+
 void visualizer_update(uint32_t default_state, uint32_t state, uint32_t leds) {
-    // Note that there's a small race condition here, the thread could read
-    // a state where one of these are set but not the other. But this should
-    // not really matter as it will be fixed during the next loop step.
-    // Alternatively a mutex could be used instead of the volatile variables
+    // This is called on every matrix scan, so the common case of nothing
+    // changing is just a comparison. The status is only written by this
+    // thread, so it can be read directly here.
+#ifdef VISUALIZER_RECORD
+    visualizer_recorder_update(&recorder, chVTGetSystemTimeX(), default_state, state, leds);
+#endif
+#ifdef VISUALIZER_PROFILE
+    if (!profile.first_scan_done) {
+        profile.first_scan_time = chVTGetSystemTimeX() - profile.start_time;
+        profile.first_scan_done = true;
+    }
+#endif
 
     bool changed = false;
 #ifdef USE_SERIAL_LINK
     if (is_serial_link_connected ()) {
+#ifdef VISUALIZER_COMPACT_STATUS
+        status_packet_t* packet = read_status_packet();
+        visualizer_keyboard_status_t decoded_status = current_status;
+        visualizer_keyboard_status_t* new_status = NULL;
+        systime_t status_time = chVTGetSystemTimeX();
+        status_link_time_t master_time;
+        if (packet && status_link_decode(packet->data, packet->size, &decoded_status, &master_time)) {
+            new_status = &decoded_status;
+#ifdef VISUALIZER_CLOCK_SYNC
+            if (STATUS_LINK_HAS_TIME(packet->data, packet->size)) {
+                chSysLock();
+                clock_sync_update(&clock_sync, master_time.time, status_time);
+                chSysUnlock();
+                status_time = master_time.time - master_time.age;
+            }
+#endif
+        }
+#else
         visualizer_keyboard_status_t* new_status = read_current_status();
+        systime_t status_time = chVTGetSystemTimeX();
+#endif
         if (new_status) {
             if (!same_status(&current_status, new_status)) {
                 changed = true;
-                current_status = *new_status;
+                publish_status(new_status, status_time);
             }
         }
     }
@@ -464,18 +1454,62 @@ void visualizer_update(uint32_t default_state, uint32_t state, uint32_t leds) {
         };
         if (!same_status(&current_status, &new_status)) {
             changed = true;
-            current_status = new_status;
+            publish_status(&new_status, get_local_status_time());
         }
     }
     update_status(changed);
+#ifdef VISUALIZER_KEY_EVENTS
+    // The thread is woken up once per scan for the new key events, the status
+    // change already did it
+    uint8_t head = key_event_head;
+    if (head != key_event_signaled_head) {
+        key_event_signaled_head = head;
+        if (!changed) {
+            chEvtBroadcast(&layer_changed_event);
+        }
+    }
+#endif
+}
+
+#ifdef VISUALIZER_KEY_EVENTS
+void visualizer_key_event(uint8_t row, uint8_t col, bool pressed) {
+    // Only the keyboard thread writes the head, so it can be read directly
+    uint8_t head = key_event_head;
+    if ((uint8_t)(head - key_event_tail) == VISUALIZER_KEY_EVENT_QUEUE_SIZE) {
+        key_event_overflows++;
+        return;
+    }
+    visualizer_key_event_t* event = &key_events[head % VISUALIZER_KEY_EVENT_QUEUE_SIZE];
+    event->time = chVTGetSystemTimeX();
+    event->row = row;
+    event->col = col;
+    event->pressed = pressed;
+    // The event has to be complete before the visualizer thread can see it
+    COMPILER_BARRIER();
+    key_event_head = head + 1;
 }
 
+uint32_t visualizer_get_key_event_overflows(void) {
+    return key_event_overflows;
+}
+#endif
+
 void visualizer_suspend(void) {
-    current_status.suspended = true;
+#ifdef VISUALIZER_RECORD
+    visualizer_recorder_suspend(&recorder, chVTGetSystemTimeX());
+#endif
+    visualizer_keyboard_status_t new_status = current_status;
+    new_status.suspended = true;
+    publish_status(&new_status, get_local_status_time());
     update_status(true);
 }
 
 void visualizer_resume(void) {
-    current_status.suspended = false;
+#ifdef VISUALIZER_RECORD
+    visualizer_recorder_resume(&recorder, chVTGetSystemTimeX());
+#endif
+    visualizer_keyboard_status_t new_status = current_status;
+    new_status.suspended = false;
+    publish_status(&new_status, get_local_status_time());
     update_status(true);
 }
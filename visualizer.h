@@ -27,13 +27,18 @@ SOFTWARE.
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
+#ifdef VISUALIZER_TRACE
+#include "visualizer_trace.h"
+#endif
 
 #ifdef LCD_ENABLE
 #include "gfx.h"
+#include "lcd_display.h"
 #endif
 
 #ifdef LCD_BACKLIGHT_ENABLE
 #include "lcd_backlight.h"
+#include "interpolation.h"
 #endif
 
 // This need to be called once at the start
@@ -45,16 +50,59 @@ void visualizer_suspend(void);
 // This should be called when the keyboard wakes up from suspend state
 void visualizer_resume(void);
 
-// If you need support for more than 8 keyframes per animation, you can change this
-#define MAX_VISUALIZER_KEY_FRAMES 8
+// The key presses and releases of the matrix scan, which are passed to the
+// visualizer thread when VISUALIZER_KEY_EVENTS is defined, for animations that
+// react to each key. The time is the system time of the scan.
+typedef struct {
+    uint32_t time;
+    uint8_t row;
+    uint8_t col;
+    bool pressed;
+} visualizer_key_event_t;
+
+// The number of key events that can wait for the visualizer thread, it can be
+// defined in config.h. It has to be a power of two, at most 128.
+#ifndef VISUALIZER_KEY_EVENT_QUEUE_SIZE
+#define VISUALIZER_KEY_EVENT_QUEUE_SIZE 16
+#endif
+
+#ifdef VISUALIZER_KEY_EVENTS
+// This should be called from the matrix scan for each key that changes, for
+// example from hook_matrix_change. It never blocks, when the queue is full the
+// event is dropped and counted.
+void visualizer_key_event(uint8_t row, uint8_t col, bool pressed);
+// The number of key events that were dropped because the queue was full
+uint32_t visualizer_get_key_event_overflows(void);
+#endif
+
+// The visualizer thread stack is filled with this value at init, so that the
+// parts that have been used can be found afterwards
+#define VISUALIZER_STACK_FILL_VALUE 0x55
+// Returns the peak stack usage of the visualizer thread since init, in bytes.
+// It includes the port specific overhead, like the space reserved for
+// interrupts, so it's directly comparable to visualizer_get_stack_size. Use
+// these to tune VISUALIZER_THREAD_STACK_SIZE in config.h.
+size_t visualizer_get_stack_high_water_mark(void);
+size_t visualizer_get_stack_size(void);
+
+// The default time between the updates of keyframes that need continuous updates
+#define DEFAULT_KEYFRAME_INTERVAL 10
+
+// The maximum number of animations that can run at the same time, it can be
+// defined in config.h. Each animation slot costs one pointer of RAM.
+#ifndef MAX_SIMULTANEOUS_ANIMATIONS
+#define MAX_SIMULTANEOUS_ANIMATIONS 32
+#endif
 
 struct keyframe_animation_t;
 
+// The status consists of 32-bit words only, so that it can be copied and
+// compared a word at a time without any padding
 typedef struct {
     uint32_t layer;
     uint32_t default_layer;
     uint32_t leds; // See led.h for available statuses
-    bool suspended;
+    uint32_t suspended;
 } visualizer_keyboard_status_t;
 
 // The state struct is used by the various keyframe functions
@@ -80,33 +128,117 @@ typedef struct visualizer_state_t {
 // Any custom keyframe function should have this signature
 // return true to get continuous updates, otherwise you will only get one
 // update per frame
+// Note that if you draw to the LCD directly with uGFX, you should call
+// lcd_display_invalidate, so that the built-in keyframes redraw everything
 typedef bool (*frame_func)(struct keyframe_animation_t*, visualizer_state_t*);
 
-// Represents a keyframe animation, so fields are internal to the system
-// while others are meant to be initialized by the user code
-typedef struct keyframe_animation_t {
-    // These should be initialized
-    int num_frames;
+typedef struct {
+    // The length of the frame in system ticks, use MS2ST to convert from
+    // milliseconds
+    int length;
+    frame_func function;
+} keyframe_t;
+
+// Describes a keyframe animation. It never changes, so it should be declared
+// const, which keeps it in flash rather than RAM
+//
+// static const keyframe_t my_keyframes[] = {
+//     {MS2ST(200), keyframe_no_operation},
+//     {MS2ST(500), keyframe_animate_backlight_color},
+// };
+// static const keyframe_animation_descriptor_t my_animation_descriptor = {
+//     KEYFRAMES(my_keyframes),
+//     .loop = false,
+// };
+// static keyframe_animation_t my_animation = { .descriptor = &my_animation_descriptor };
+typedef struct {
+    const keyframe_t* keyframes;
+    int16_t num_frames;
     bool loop;
-    int frame_lengths[MAX_VISUALIZER_KEY_FRAMES];
-    frame_func frame_functions[MAX_VISUALIZER_KEY_FRAMES];
+    // The minimum time between updates for keyframes that need continuous
+    // updates, if not set DEFAULT_KEYFRAME_INTERVAL is used
+    uint16_t frame_interval;
+} keyframe_animation_descriptor_t;
+
+// Sets the keyframes of a descriptor, and the number of them, from an array
+#define KEYFRAMES(array) .keyframes = (array), .num_frames = sizeof(array) / sizeof((array)[0])
+
+#ifdef LCD_BACKLIGHT_ENABLE
+// The interpolation of the backlight color of an animation, used internally.
+// It's set up when a frame starts, or the colors change, and then reused for
+// the rest of the frame.
+typedef struct {
+    int16_t frame;
+    uint32_t from;
+    uint32_t to;
+    interpolation_t interpolation;
+    interpolated_value_t hue;
+    interpolated_value_t saturation;
+    interpolated_value_t intensity;
+} keyframe_backlight_fade_t;
+#endif
+
+// A running instance of a keyframe animation, only the descriptor should be
+// initialized by the user code
+typedef struct keyframe_animation_t {
+    const keyframe_animation_descriptor_t* descriptor;
 
     // Used internally by the system, and can also be read by
     // keyframe update functions
-    int current_frame;
-    int time_left_in_frame;
+    int16_t current_frame;
     bool need_update;
+    int time_left_in_frame;
+    // Keyframe functions that need continuous updates can set this to the
+    // time until their output changes the next time, and no updates are done
+    // before that. It's reset to zero before each call.
+    int time_to_next_update;
+    // Keyframe functions that draw in parts, see keyframe_slice_expired, set
+    // this to non-zero when they return before they are done. They are then
+    // called again on the next tick with the same value, and the frame doesn't
+    // end until they set it back to zero. It's reset to zero when the
+    // animation is started or stopped.
+    uint16_t slice;
 
+    // Used internally by the scheduler
+    int16_t scheduler_index;
+    uint32_t last_update_time;
+    uint32_t next_update_time;
+#ifdef VISUALIZER_TRACE
+    // The status change that started the animation, and the
+    // VISUALIZER_TRACE_ stages that are still to be recorded for it
+    uint16_t trace_id;
+    uint8_t trace_stages;
+#endif
+#ifdef LCD_BACKLIGHT_ENABLE
+    // Each animation has its own, so that animations that fade the backlight
+    // at the same time don't have to set them up again on every update
+    keyframe_backlight_fade_t backlight_fade;
+#endif
 } keyframe_animation_t;
 
-void start_keyframe_animation(keyframe_animation_t* animation);
+// Returns false if the animation couldn't be started, because there are
+// already MAX_SIMULTANEOUS_ANIMATIONS animations running
+bool start_keyframe_animation(keyframe_animation_t* animation);
 void stop_keyframe_animation(keyframe_animation_t* animation);
 
+// A keyframe function that does a lot of work can call this between the parts
+// of it, and when it returns true, store where it was in animation->slice and
+// return, so that the lower priority threads get to run. The budget is
+// VISUALIZER_TIME_SLICE microseconds, counted from when the visualizer thread
+// woke up. Without VISUALIZER_TIME_SLICE this always returns false.
+bool keyframe_slice_expired(void);
+
 // Some predefined keyframe functions that can be used by the user code
 // Does nothing, useful for adding delays
 bool keyframe_no_operation(keyframe_animation_t* animation, visualizer_state_t* state);
 // Animates the LCD backlight color between the current color and the target color (of the state)
 bool keyframe_animate_backlight_color(keyframe_animation_t* animation, visualizer_state_t* state);
+// The same with easing curves, see interpolation.h. They cost the same as
+// the linear one.
+bool keyframe_animate_backlight_color_ease_in(keyframe_animation_t* animation, visualizer_state_t* state);
+bool keyframe_animate_backlight_color_ease_out(keyframe_animation_t* animation, visualizer_state_t* state);
+bool keyframe_animate_backlight_color_ease_in_out(keyframe_animation_t* animation, visualizer_state_t* state);
+bool keyframe_animate_backlight_color_smoothstep(keyframe_animation_t* animation, visualizer_state_t* state);
 // Sets the backlight color to the target color
 bool keyframe_set_backlight_color(keyframe_animation_t* animation, visualizer_state_t* state);
 // Displays the layer text centered vertically on the screen
@@ -121,11 +253,123 @@ bool keyframe_enable_lcd_and_backlight(keyframe_animation_t* animation, visualiz
 // directly from the initalize_user_visualizer function (the animation can be null)
 bool enable_visualization(keyframe_animation_t* animation, visualizer_state_t* state);
 
-// These two functions have to be implemented by the user
+// Bits of the visualizer_status_change_t changed mask
+#define VISUALIZER_CHANGED_LAYER (1u << 0)
+#define VISUALIZER_CHANGED_DEFAULT_LAYER (1u << 1)
+#define VISUALIZER_CHANGED_LEDS (1u << 2)
+#define VISUALIZER_CHANGED_SUSPENDED (1u << 3)
+
+typedef struct {
+    // The VISUALIZER_CHANGED_ bits of the fields that are different
+    uint32_t changed;
+    // The status before the change, the new one is in the state
+    visualizer_keyboard_status_t previous;
+} visualizer_status_change_t;
+
+// Timing profile of the visualizer thread, which is collected when
+// VISUALIZER_PROFILE is defined. The times are in ticks of the ChibiOS
+// realtime counter, see chSysGetRealtimeCounterX, counter_frequency tells
+// how many there are per second.
+#ifndef VISUALIZER_PROFILE_MAX_FUNCTIONS
+#define VISUALIZER_PROFILE_MAX_FUNCTIONS 16
+#endif
+// Bucket n of the histograms counts the calls that took from 2^n to
+// 2^(n+1)-1 ticks, the first one also counts zero, and the last one
+// everything longer. The counts stop at 0xFFFF.
+#define VISUALIZER_PROFILE_BUCKETS 24
+
+typedef struct {
+    frame_func function;
+    uint32_t calls;
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;
+    uint16_t histogram[VISUALIZER_PROFILE_BUCKETS];
+} visualizer_frame_profile_t;
+
+typedef struct {
+    uint32_t counter_frequency;
+    // The system time when the visualizer was started
+    uint32_t start_time;
+    // The number of times the visualizer thread woke up, and the time it
+    // spent running, the rest of the time it was sleeping
+    uint32_t wakeups;
+    uint64_t busy;
+    // The longest time the thread ran at once, which is the time it kept the
+    // lower priority threads from running, and the number of times a keyframe
+    // function returned before it was done, see keyframe_slice_expired
+    uint32_t max_busy;
+    uint32_t yields;
+    // The system ticks from visualizer_init to the first visualizer_update
+    // call, which the keyboard makes from its first matrix scan, and to the
+    // end of the first update of the visualizer thread, when the display has
+    // been initialized and the first frame drawn. The times are valid when the
+    // corresponding done flag is set.
+    uint32_t first_scan_time;
+    uint32_t first_frame_time;
+    bool first_scan_done;
+    bool first_frame_done;
+    // The key events passed to user_visualizer_key_events, and the number of
+    // calls it took, see VISUALIZER_KEY_EVENTS
+    uint32_t key_events;
+    uint32_t key_event_batches;
+    // The calls of the frame functions that didn't fit in the table
+    uint32_t untracked_calls;
+    uint32_t num_functions;
+    visualizer_frame_profile_t functions[VISUALIZER_PROFILE_MAX_FUNCTIONS];
+} visualizer_profile_t;
+
+#ifdef VISUALIZER_PROFILE
+// The profile is updated by the visualizer thread without locking, so when
+// reading it from another thread a value can occasionally be off by one call
+const visualizer_profile_t* visualizer_get_profile(void);
+// Prints the profile to the debug console
+void visualizer_print_profile(void);
+#endif
+
+#ifdef VISUALIZER_TRACE
+// The latency trace of the status changes, which is collected when
+// VISUALIZER_TRACE is defined, see visualizer_trace.h. The timestamps are
+// from VISUALIZER_TRACE_TIMESTAMP(), by default the ChibiOS realtime counter.
+// Copies the trace, this can be called from any thread.
+void visualizer_get_trace(visualizer_trace_t* trace);
+// Prints the latency percentiles of each stage to the debug console
+void visualizer_print_trace(void);
+#endif
+
+#ifdef VISUALIZER_RECORD
+// The recording of the visualizer_update, visualizer_suspend and
+// visualizer_resume calls since visualizer_init, which is made when
+// VISUALIZER_RECORD is defined, see visualizer_record.h. Call this from the
+// keyboard thread, it can continue recording afterwards.
+const uint8_t* visualizer_get_recording(size_t* size);
+#endif
+
+#ifdef VISUALIZER_CLOCK_SYNC
+#include "clock_sync.h"
+// Copies the estimate of the clock of the master that a slave runs the
+// animations on, see VISUALIZER_CLOCK_SYNC. It can be called from any thread.
+void visualizer_get_clock_sync(clock_sync_t* sync);
+#endif
+
+// These functions have to be implemented by the user
 void initialize_user_visualizer(visualizer_state_t* state);
+// Implement either of these two. The second one tells which parts of the
+// status changed, so that the user code can leave alone the animations that
+// are not affected. By default it calls the first one. Note that the first
+// one always sets prev_lcd_color to current_lcd_color after the call, with the
+// second one you should do that yourself when starting a new color animation.
 void update_user_visualizer_state(visualizer_state_t* state);
+void update_user_visualizer_state_changes(visualizer_state_t* state, const visualizer_status_change_t* change);
 void user_visualizer_suspend(visualizer_state_t* state);
 void user_visualizer_resume(visualizer_state_t* state);
+// Optionally implement this, to get the key events when VISUALIZER_KEY_EVENTS
+// is defined. It's called each time the visualizer thread wakes up, with the
+// events in the order they happened, in place in the queue, so a batch that
+// wraps around the end of the queue is passed in two calls. The events that
+// come while the visualizer is disabled, during the startup animation or
+// suspend, are dropped.
+void user_visualizer_key_events(visualizer_state_t* state, const visualizer_key_event_t* events, uint8_t count);
 
 
 #endif /* VISUALIZER_H */
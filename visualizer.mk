@@ -25,14 +25,26 @@ ifdef LCD_ENABLE
 include $(GFXLIB)/gfx.mk
 UDEFS += -DLCD_ENABLE
 ULIBS += -lm
+SRC += $(VISUALIZER_DIR)/lcd_display.c
 endif
 SRC += $(GFXSRC) $(VISUALIZER_DIR)/visualizer.c
+SRC += $(VISUALIZER_DIR)/status_link.c
+SRC += $(VISUALIZER_DIR)/clock_sync.c
+SRC += $(VISUALIZER_DIR)/visualizer_trace.c
+SRC += $(VISUALIZER_DIR)/visualizer_record.c
 UINCDIR += $(GFXINC) $(VISUALIZER_DIR)
 
 ifdef LCD_BACKLIGHT_ENABLE
 SRC += $(VISUALIZER_DIR)/lcd_backlight.c
+SRC += $(VISUALIZER_DIR)/interpolation.c
 SRC += lcd_backlight_hal.c
 UDEFS += -DLCD_BACKLIGHT_ENABLE
+ifdef LCD_BACKLIGHT_FIXED_POINT
+UDEFS += -DLCD_BACKLIGHT_FIXED_POINT
+endif
+ifdef LCD_BACKLIGHT_WAVEFORM
+UDEFS += -DLCD_BACKLIGHT_WAVEFORM
+endif
 endif
 
 ifndef VISUALIZER_USER
@@ -0,0 +1,223 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Fred Sundvik
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "visualizer_record.h"
+#include "varint.h"
+#include <string.h>
+
+#define RECORD_IDLE 0
+#define RECORD_TYPE_MASK 0x3
+#define RECORD_FIELDS_SHIFT 2
+#define RECORD_ALL_FIELDS (VISUALIZER_RECORD_DEFAULT_LAYER | VISUALIZER_RECORD_LAYER | \
+    VISUALIZER_RECORD_LEDS)
+// The type byte, the time and three arguments
+#define MAX_RECORD_SIZE (1 + 4 * 5)
+
+// Returns where the record goes, or NULL when it doesn't fit. The recording
+// stops there, so that it's always complete up to some point.
+static uint8_t* begin_record(visualizer_recorder_t* recorder, uint8_t type, uint32_t time) {
+    if (recorder->full || recorder->size - recorder->used < MAX_RECORD_SIZE) {
+        recorder->full = true;
+        return NULL;
+    }
+    uint8_t* p = recorder->buffer + recorder->used;
+    *p++ = type;
+    p = varint_encode(p, time - recorder->time);
+    recorder->time = time;
+    return p;
+}
+
+static void end_record(visualizer_recorder_t* recorder, uint8_t* p) {
+    recorder->used = p - recorder->buffer;
+}
+
+void visualizer_recorder_init(visualizer_recorder_t* recorder, uint8_t* buffer, size_t size,
+        uint32_t start_time, uint32_t frequency) {
+    memset(recorder, 0, sizeof(*recorder));
+    recorder->buffer = buffer;
+    recorder->size = size;
+    recorder->time = start_time;
+    if (size < 3 + 5) {
+        recorder->full = true;
+        return;
+    }
+    uint8_t* p = buffer;
+    *p++ = 'V';
+    *p++ = 'R';
+    *p++ = VISUALIZER_RECORD_VERSION;
+    p = varint_encode(p, frequency);
+    end_record(recorder, p);
+}
+
+void visualizer_recorder_flush(visualizer_recorder_t* recorder) {
+    if (recorder->idle_calls == 0) {
+        return;
+    }
+    uint8_t* p = begin_record(recorder, RECORD_IDLE, recorder->idle_time);
+    if (p) {
+        p = varint_encode(p, recorder->idle_calls);
+        end_record(recorder, p);
+    }
+    recorder->idle_calls = 0;
+}
+
+void visualizer_recorder_update(visualizer_recorder_t* recorder, uint32_t time,
+        uint32_t default_layer, uint32_t layer, uint32_t leds) {
+    uint8_t fields = RECORD_ALL_FIELDS;
+    if (recorder->has_arguments) {
+        fields = 0;
+        if (default_layer != recorder->default_layer) {
+            fields |= VISUALIZER_RECORD_DEFAULT_LAYER;
+        }
+        if (layer != recorder->layer) {
+            fields |= VISUALIZER_RECORD_LAYER;
+        }
+        if (leds != recorder->leds) {
+            fields |= VISUALIZER_RECORD_LEDS;
+        }
+    }
+    if (fields == 0) {
+        recorder->idle_calls++;
+        recorder->idle_time = time;
+        return;
+    }
+    visualizer_recorder_flush(recorder);
+    uint8_t* p = begin_record(recorder, VISUALIZER_RECORD_UPDATE | (fields << RECORD_FIELDS_SHIFT), time);
+    if (p == NULL) {
+        return;
+    }
+    if (fields & VISUALIZER_RECORD_DEFAULT_LAYER) {
+        p = varint_encode(p, default_layer);
+    }
+    if (fields & VISUALIZER_RECORD_LAYER) {
+        p = varint_encode(p, layer);
+    }
+    if (fields & VISUALIZER_RECORD_LEDS) {
+        p = varint_encode(p, leds);
+    }
+    end_record(recorder, p);
+    recorder->has_arguments = true;
+    recorder->default_layer = default_layer;
+    recorder->layer = layer;
+    recorder->leds = leds;
+}
+
+static void record_call(visualizer_recorder_t* recorder, uint8_t type, uint32_t time) {
+    visualizer_recorder_flush(recorder);
+    uint8_t* p = begin_record(recorder, type, time);
+    if (p) {
+        end_record(recorder, p);
+    }
+}
+
+void visualizer_recorder_suspend(visualizer_recorder_t* recorder, uint32_t time) {
+    record_call(recorder, VISUALIZER_RECORD_SUSPEND, time);
+}
+
+void visualizer_recorder_resume(visualizer_recorder_t* recorder, uint32_t time) {
+    record_call(recorder, VISUALIZER_RECORD_RESUME, time);
+}
+
+bool visualizer_replay_init(visualizer_replay_t* replay, const uint8_t* data, size_t size) {
+    memset(replay, 0, sizeof(*replay));
+    const uint8_t* end = data + size;
+    if (size < 4 || data[0] != 'V' || data[1] != 'R' || data[2] != VISUALIZER_RECORD_VERSION) {
+        return false;
+    }
+    replay->data = varint_decode(data + 3, end, &replay->frequency);
+    replay->end = end;
+    return replay->data != NULL && replay->frequency != 0;
+}
+
+bool visualizer_replay_next(visualizer_replay_t* replay, visualizer_record_event_t* event) {
+    if (replay->idle_call < replay->idle_calls) {
+        replay->idle_call++;
+        replay->last.type = VISUALIZER_RECORD_UPDATE;
+        replay->last.time = replay->idle_start +
+            (uint64_t)replay->idle_length * replay->idle_call / replay->idle_calls;
+        *event = replay->last;
+        return true;
+    }
+    while (replay->data != replay->end) {
+        const uint8_t* p = replay->data;
+        uint8_t type = *p++;
+        uint32_t delta;
+        p = varint_decode(p, replay->end, &delta);
+        if (p == NULL) {
+            replay->error = true;
+            return false;
+        }
+        uint32_t time = replay->last.time + delta;
+        uint8_t fields = type >> RECORD_FIELDS_SHIFT;
+        switch (type & RECORD_TYPE_MASK) {
+        case RECORD_IDLE: {
+            uint32_t calls;
+            p = varint_decode(p, replay->end, &calls);
+            if (p == NULL || fields != 0) {
+                replay->error = true;
+                return false;
+            }
+            replay->data = p;
+            if (calls == 0) {
+                continue;
+            }
+            replay->idle_calls = calls;
+            replay->idle_call = 0;
+            replay->idle_start = replay->last.time;
+            replay->idle_length = delta;
+            return visualizer_replay_next(replay, event);
+        }
+        case VISUALIZER_RECORD_UPDATE:
+            if (fields & VISUALIZER_RECORD_DEFAULT_LAYER) {
+                p = p ? varint_decode(p, replay->end, &replay->last.default_layer) : NULL;
+            }
+            if (fields & VISUALIZER_RECORD_LAYER) {
+                p = p ? varint_decode(p, replay->end, &replay->last.layer) : NULL;
+            }
+            if (fields & VISUALIZER_RECORD_LEDS) {
+                p = p ? varint_decode(p, replay->end, &replay->last.leds) : NULL;
+            }
+            if (p == NULL || (fields & ~RECORD_ALL_FIELDS)) {
+                replay->error = true;
+                return false;
+            }
+            break;
+        default:
+            if (fields != 0) {
+                replay->error = true;
+                return false;
+            }
+            break;
+        }
+        replay->data = p;
+        replay->idle_calls = 0;
+        replay->idle_call = 0;
+        replay->last.type = type & RECORD_TYPE_MASK;
+        replay->last.time = time;
+        *event = replay->last;
+        return true;
+    }
+    return false;
+}
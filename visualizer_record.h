@@ -0,0 +1,122 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Fred Sundvik
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#ifndef VISUALIZER_RECORD_H_
+#define VISUALIZER_RECORD_H_
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// A compact binary recording of the calls that the keyboard makes to the
+// visualizer, visualizer_update, visualizer_suspend and visualizer_resume,
+// which can be replayed on the host.
+//
+// The recording starts with the bytes 'V', 'R', the format version and the
+// frequency of the timestamps. Each record after that starts with a byte
+// that has the record type in the low two bits, and for an update the
+// VISUALIZER_RECORD_ bits of the arguments that are in the record above them.
+// It's followed by the time since the previous record, the arguments that
+// changed, in the order of the bits, and for an idle record the number of
+// calls. All the numbers are variable length integers with seven bits per
+// byte, least significant first. visualizer_update is called on every matrix
+// scan, and the calls that don't change the arguments are counted into an
+// idle record, which is written before the next change. The time of the idle
+// record is the time of the last call, the others are assumed to be evenly
+// spread since the previous record.
+
+#define VISUALIZER_RECORD_VERSION 1
+
+// The arguments of visualizer_update
+#define VISUALIZER_RECORD_DEFAULT_LAYER (1u << 0)
+#define VISUALIZER_RECORD_LAYER (1u << 1)
+#define VISUALIZER_RECORD_LEDS (1u << 2)
+
+typedef enum {
+    VISUALIZER_RECORD_UPDATE = 1,
+    VISUALIZER_RECORD_SUSPEND,
+    VISUALIZER_RECORD_RESUME,
+} visualizer_record_type_t;
+
+typedef struct {
+    uint8_t* buffer;
+    size_t size;
+    size_t used;
+    // Set when a record didn't fit, nothing is recorded after that
+    bool full;
+    // The time of the last record, and the arguments of the last update
+    uint32_t time;
+    bool has_arguments;
+    uint32_t default_layer;
+    uint32_t layer;
+    uint32_t leds;
+    // The unchanged updates since the last record
+    uint32_t idle_calls;
+    uint32_t idle_time;
+} visualizer_recorder_t;
+
+// The recording goes to the buffer, the times are counted from start_time,
+// and are in ticks of the given frequency
+void visualizer_recorder_init(visualizer_recorder_t* recorder, uint8_t* buffer, size_t size,
+        uint32_t start_time, uint32_t frequency);
+void visualizer_recorder_update(visualizer_recorder_t* recorder, uint32_t time,
+        uint32_t default_layer, uint32_t layer, uint32_t leds);
+void visualizer_recorder_suspend(visualizer_recorder_t* recorder, uint32_t time);
+void visualizer_recorder_resume(visualizer_recorder_t* recorder, uint32_t time);
+// Writes the pending idle record, so that the recording is complete up to
+// now. Recording can continue after this.
+void visualizer_recorder_flush(visualizer_recorder_t* recorder);
+
+typedef struct {
+    uint8_t type;
+    // Counted from the start of the recording
+    uint32_t time;
+    // The arguments of an update
+    uint32_t default_layer;
+    uint32_t layer;
+    uint32_t leds;
+} visualizer_record_event_t;
+
+typedef struct {
+    const uint8_t* data;
+    const uint8_t* end;
+    uint32_t frequency;
+    // Set when the recording ends in the middle of a record
+    bool error;
+    visualizer_record_event_t last;
+    // The updates of the idle record that are still to be returned
+    uint32_t idle_calls;
+    uint32_t idle_call;
+    uint32_t idle_start;
+    uint32_t idle_length;
+} visualizer_replay_t;
+
+// Returns false if the data doesn't start with a header of a supported
+// version
+bool visualizer_replay_init(visualizer_replay_t* replay, const uint8_t* data, size_t size);
+// Returns the next call, with the idle records expanded into the individual
+// updates, or false at the end of the recording
+bool visualizer_replay_next(visualizer_replay_t* replay, visualizer_record_event_t* event);
+
+#endif /* VISUALIZER_RECORD_H_ */
@@ -0,0 +1,152 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Fred Sundvik
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "visualizer_trace.h"
+#include <stdbool.h>
+#include <string.h>
+
+#define COMPILER_BARRIER() __asm__ volatile("" ::: "memory")
+
+static bool before(uint32_t time1, uint32_t time2) {
+    return (int32_t)(time1 - time2) < 0;
+}
+
+void visualizer_trace_record(visualizer_trace_ring_t* ring, uint8_t stage, uint16_t id, uint32_t time) {
+    uint32_t head = ring->head;
+    visualizer_trace_event_t* event = &ring->events[head % VISUALIZER_TRACE_SIZE];
+    event->time = time;
+    event->id = id;
+    event->stage = stage;
+    // The event has to be complete before the readers see it
+    COMPILER_BARRIER();
+    ring->head = head + 1;
+}
+
+size_t visualizer_trace_read(const visualizer_trace_ring_t* ring, visualizer_trace_event_t* events) {
+    uint32_t head = ring->head;
+    COMPILER_BARRIER();
+    uint32_t start = head > VISUALIZER_TRACE_SIZE ? head - VISUALIZER_TRACE_SIZE : 0;
+    for (uint32_t i = start; i != head; i++) {
+        events[i - start] = ring->events[i % VISUALIZER_TRACE_SIZE];
+    }
+    COMPILER_BARRIER();
+    // The owner may have overwritten the oldest events while they were
+    // copied, and be in the middle of writing the slot of the one after them
+    uint32_t new_head = ring->head;
+    uint32_t valid = new_head >= VISUALIZER_TRACE_SIZE ? new_head - VISUALIZER_TRACE_SIZE + 1 : 0;
+    if ((int32_t)(valid - start) <= 0) {
+        return head - start;
+    }
+    if ((int32_t)(valid - head) >= 0) {
+        return 0;
+    }
+    memmove(events, events + (valid - start), (head - valid) * sizeof(visualizer_trace_event_t));
+    return head - valid;
+}
+
+void visualizer_trace_merge(visualizer_trace_t* trace, const visualizer_trace_ring_t* ring) {
+    visualizer_trace_event_t* events = trace->events;
+    size_t old_events = trace->num_events;
+    size_t num_events = old_events + visualizer_trace_read(ring, events + old_events);
+    // Both parts are already ordered, the events of the ring go after the
+    // ones with the same time
+    for (size_t i = old_events; i < num_events; i++) {
+        visualizer_trace_event_t event = events[i];
+        size_t j = i;
+        while (j > 0 && before(event.time, events[j - 1].time)) {
+            events[j] = events[j - 1];
+            j--;
+        }
+        events[j] = event;
+    }
+    trace->num_events = num_events;
+}
+
+// Nearest rank percentile of the sorted latencies
+static uint32_t percentile(const uint32_t* latencies, uint32_t count, uint32_t percent) {
+    return latencies[(count * percent + 99) / 100 - 1];
+}
+
+void visualizer_trace_analyze(const visualizer_trace_t* trace,
+        visualizer_trace_latency_t latencies[VISUALIZER_TRACE_NUM_STAGES]) {
+    const visualizer_trace_event_t* events = trace->events;
+    size_t num_events = trace->num_events;
+    bool has_oldest = false;
+    uint32_t oldest = 0;
+    for (size_t i = 0; i < num_events; i++) {
+        if (events[i].stage >= VISUALIZER_TRACE_WAKEUP) {
+            oldest = events[i].time;
+            has_oldest = true;
+            break;
+        }
+    }
+    for (uint8_t stage = 0; stage < VISUALIZER_TRACE_NUM_STAGES; stage++) {
+        uint32_t samples[VISUALIZER_TRACE_SIZE];
+        uint32_t count = 0;
+        for (size_t i = 0; i < num_events && count < VISUALIZER_TRACE_SIZE; i++) {
+            const visualizer_trace_event_t* change = &events[i];
+            if (change->stage != VISUALIZER_TRACE_STATUS ||
+                    (has_oldest && before(change->time, oldest))) {
+                continue;
+            }
+            // The first event of the stage for the same change
+            for (size_t j = i; j < num_events; j++) {
+                if (events[j].stage == stage && events[j].id == change->id) {
+                    uint32_t latency = events[j].time - change->time;
+                    size_t k = count++;
+                    while (k > 0 && samples[k - 1] > latency) {
+                        samples[k] = samples[k - 1];
+                        k--;
+                    }
+                    samples[k] = latency;
+                    break;
+                }
+            }
+        }
+        visualizer_trace_latency_t* latency = &latencies[stage];
+        memset(latency, 0, sizeof(*latency));
+        latency->count = count;
+        if (count > 0) {
+            latency->p50 = percentile(samples, count, 50);
+            latency->p90 = percentile(samples, count, 90);
+            latency->p99 = percentile(samples, count, 99);
+            latency->max = samples[count - 1];
+        }
+    }
+}
+
+const char* visualizer_trace_stage_name(uint8_t stage) {
+    static const char* const names[VISUALIZER_TRACE_NUM_STAGES] = {
+        "status",
+        "broadcast",
+        "wakeup",
+        "user_state",
+        "animation_start",
+        "frame",
+        "lcd",
+        "backlight",
+    };
+    return stage < VISUALIZER_TRACE_NUM_STAGES ? names[stage] : "unknown";
+}
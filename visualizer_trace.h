@@ -0,0 +1,118 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Fred Sundvik
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#ifndef VISUALIZER_TRACE_H_
+#define VISUALIZER_TRACE_H_
+#include <stdint.h>
+#include <stddef.h>
+
+// Latency tracing of the keyboard status changes, from the matrix scan that
+// sees a change to the LCD and backlight updates that show it. Every change
+// gets a 16-bit id, and each stage that it goes through is recorded with that
+// id and a timestamp into a ring buffer. There is one ring per thread, and
+// only that thread writes to it, so recording doesn't need any locking. The
+// oldest events are overwritten when a ring is full.
+
+// The number of events in each ring
+#ifndef VISUALIZER_TRACE_SIZE
+#define VISUALIZER_TRACE_SIZE 64
+#endif
+
+typedef enum {
+    // Recorded by the keyboard thread
+    // visualizer_update saw the change
+    VISUALIZER_TRACE_STATUS,
+    // The visualizer thread was signalled
+    VISUALIZER_TRACE_BROADCAST,
+    // Recorded by the visualizer thread
+    // The visualizer thread woke up and read the new status
+    VISUALIZER_TRACE_WAKEUP,
+    // The user code was called with the change
+    VISUALIZER_TRACE_USER_STATE,
+    // The user code started an animation
+    VISUALIZER_TRACE_ANIMATION_START,
+    // The first frame function of an animation started for the change ran
+    VISUALIZER_TRACE_FRAME,
+    // Such an animation flushed the LCD, or switched it on or off. With
+    // LCD_ASYNC_FLUSH this is when the transfer was started or queued.
+    VISUALIZER_TRACE_LCD,
+    // Such an animation set the backlight color, or started a fade
+    VISUALIZER_TRACE_BACKLIGHT,
+    VISUALIZER_TRACE_NUM_STAGES,
+} visualizer_trace_stage_t;
+
+typedef struct {
+    uint32_t time;
+    uint16_t id;
+    uint8_t stage;
+} visualizer_trace_event_t;
+
+typedef struct {
+    // The number of events ever recorded, the next one goes to
+    // events[head % VISUALIZER_TRACE_SIZE]
+    volatile uint32_t head;
+    visualizer_trace_event_t events[VISUALIZER_TRACE_SIZE];
+} visualizer_trace_ring_t;
+
+// The events of all the rings, ordered by time
+typedef struct {
+    // The timestamps are in ticks of this frequency
+    uint32_t counter_frequency;
+    size_t num_events;
+    visualizer_trace_event_t events[2 * VISUALIZER_TRACE_SIZE];
+} visualizer_trace_t;
+
+// The latencies of a stage from the status change, in timestamp ticks.
+// count is the number of changes that reached the stage, for
+// VISUALIZER_TRACE_STATUS the number of changes in the trace. A change can
+// skip the later stages, for example when the next change comes before the
+// visualizer thread has woken up.
+typedef struct {
+    uint32_t count;
+    uint32_t p50;
+    uint32_t p90;
+    uint32_t p99;
+    uint32_t max;
+} visualizer_trace_latency_t;
+
+// Only the thread that owns the ring may call this
+void visualizer_trace_record(visualizer_trace_ring_t* ring, uint8_t stage, uint16_t id, uint32_t time);
+// Copies the events of a ring to events, which has room for
+// VISUALIZER_TRACE_SIZE events, oldest first, and returns their number. This
+// can be called from any thread, the events that the owner overwrites during
+// the copy are left out. So is the oldest one of a full ring, since the owner
+// might be writing over it.
+size_t visualizer_trace_read(const visualizer_trace_ring_t* ring, visualizer_trace_event_t* events);
+// Adds the events of a ring to the trace, keeping it ordered by time
+void visualizer_trace_merge(visualizer_trace_t* trace, const visualizer_trace_ring_t* ring);
+// Computes the latency percentiles of each stage. Only the changes that are
+// newer than the oldest visualizer thread event are counted, since the
+// events of the older ones may have been overwritten.
+void visualizer_trace_analyze(const visualizer_trace_t* trace,
+        visualizer_trace_latency_t latencies[VISUALIZER_TRACE_NUM_STAGES]);
+// The name of a stage, for printing
+const char* visualizer_trace_stage_name(uint8_t stage);
+
+#endif /* VISUALIZER_TRACE_H_ */